@@ -33,8 +33,15 @@ cl /Ox /EHsc /GL /Fohelpers.obj /c helpers.cpp  ^
  && cl /Ox /EHsc /GL /Foratiohistogram.obj /c ratiohistogram.cpp ^
  && cl /Ox /EHsc /GL /Fohistogram.obj /c histogram.cpp ^
  && cl /Ox /EHsc /GL /Fomeanhistogram.obj /c meanhistogram.cpp ^
+ && cl /Ox /EHsc /GL /Fosampling.obj /c sampling.cpp ^
+ && cl /Ox /EHsc /GL /Focolumncache.obj /c columncache.cpp ^
+ && cl /Ox /EHsc /GL /Fobinkernels.obj /c binkernels.cpp ^
+ && cl /Ox /EHsc /GL /Fogrouping.obj /c grouping.cpp ^
+ && cl /Ox /EHsc /GL /Fohistogram2d.obj /c histogram2d.cpp ^
+ && cl /Ox /EHsc /GL /Foautorange.obj /c autorange.cpp ^
+ && cl /Ox /EHsc /GL /Fohdrhistogram.obj /c hdrhistogram.cpp ^
  && cl /Ox /EHsc /GL /FoRegistExt.obj /c RegistExt.cpp ^
- && link /DLL /LTCG /OUT:histograms.dll helpers.obj SQLiteExt.obj RegistExt.obj meanhistogram.obj histogram.obj ratiohistogram.obj
+ && link /DLL /LTCG /OUT:histograms.dll helpers.obj SQLiteExt.obj RegistExt.obj meanhistogram.obj histogram.obj ratiohistogram.obj sampling.obj columncache.obj binkernels.obj grouping.obj histogram2d.obj autorange.obj hdrhistogram.obj
 
 With debug info:
 
@@ -43,13 +50,20 @@ cl /Fohelpers.obj /c helpers.cpp /DDEBUG /ZI /EHsc ^
  && cl /Foratiohistogram.obj /c ratiohistogram.cpp /DDEBUG  /ZI /EHsc ^
  && cl /Fomeanhistogram.obj /c meanhistogram.cpp /DDEBUG  /ZI /EHsc ^
  && cl /Fohistogram.obj /c histogram.cpp /DDEBUG  /ZI /EHsc ^
+ && cl /Fosampling.obj /c sampling.cpp /DDEBUG  /ZI /EHsc ^
+ && cl /Focolumncache.obj /c columncache.cpp /DDEBUG  /ZI /EHsc ^
+ && cl /Fobinkernels.obj /c binkernels.cpp /DDEBUG  /ZI /EHsc ^
+ && cl /Fogrouping.obj /c grouping.cpp /DDEBUG  /ZI /EHsc ^
+ && cl /Fohistogram2d.obj /c histogram2d.cpp /DDEBUG  /ZI /EHsc ^
+ && cl /Foautorange.obj /c autorange.cpp /DDEBUG  /ZI /EHsc ^
+ && cl /Fohdrhistogram.obj /c hdrhistogram.cpp /DDEBUG  /ZI /EHsc ^
  && cl /FoRegistExt.obj /c RegistExt.cpp  /DDEBUG  /ZI /EHsc ^
- && link /DLL /DEBUG /debugtype:cv /OUT:histograms.dll helpers.obj SQLiteExt.obj meanhistogram.obj RegistExt.obj histogram.obj ratiohistogram.obj
+ && link /DLL /DEBUG /debugtype:cv /OUT:histograms.dll helpers.obj SQLiteExt.obj meanhistogram.obj RegistExt.obj histogram.obj ratiohistogram.obj sampling.obj columncache.obj binkernels.obj grouping.obj histogram2d.obj autorange.obj hdrhistogram.obj
 
  
 Compile on Linux:
 
- g++ -fPIC -lm -shared histogram.cpp helpers.cpp meanhistogram.cpp ratiohistogram.cpp RegistExt.cpp -o libhistograms.so
+ g++ -fPIC -pthread -lm -shared histogram.cpp helpers.cpp meanhistogram.cpp ratiohistogram.cpp sampling.cpp columncache.cpp binkernels.cpp grouping.cpp histogram2d.cpp autorange.cpp hdrhistogram.cpp SQLiteExt.cpp RegistExt.cpp -o libhistograms.so
 
  From the sqlite commandline load the extension
 
@@ -65,6 +79,7 @@ Compile on Linux:
 
 
 #include "RegistExt.h"
+#include "helpers.h"
 
 
 #ifdef __cplusplus
@@ -93,23 +108,46 @@ int sqlite3_histograms_init( // always use lower case
   int rc = SQLITE_OK;
   SQLITE_EXTENSION_INIT2(pApi);
 #ifndef SQLITE_OMIT_VIRTUALTABLE
-  if (sqlite3_libversion_number()<3008012)
+  /* The headers are those of SQLite 3.40.1 but apart from table-valued pragma functions, which
+  need 3.16.0, only interfaces of older versions are called unconditionally. Newer interfaces 
+  are only called once the library is known to have them as sqlite3_api_routines of an older
+  library ends before them: sqlite3_create_window_function() of 3.25.0 below and 
+  sqlite3_vtab_in() of 3.38.0 behind HasVtabIn().
+  */
+  if (sqlite3_libversion_number()<3016000)
   {
-    *pzErrMsg = sqlite3_mprintf("Histogram extension requires SQLite 3.8.12 or later");
+    *pzErrMsg = sqlite3_mprintf("Histogram extension requires SQLite 3.16.0 or later");
     return SQLITE_ERROR;
   }
+  // use the fastest binning kernel the CPU supports
+  histoconfig.binkernel = SelectBinKernel(BINKERNEL_AVX512);
+
   rc = sqlite3_create_module(db, "HISTO", &histoModule, 0);
   rc = sqlite3_create_module(db, "RATIOHISTO", &ratiohistoModule, 0);
   rc = sqlite3_create_module(db, "MEANHISTO", &meanhistoModule, 0);
+  rc = sqlite3_create_module(db, "HISTO2D", &histo2dModule, 0);
+  rc = sqlite3_create_module(db, "HDRHISTO", &hdrhistoModule, 0);
 
   // 3. parameter is the number of arguments the functions take 
   sqlite3_create_function(db, "SQRT", 1, SQLITE_ANY, 0, sqrtFunc, 0, 0);
   sqlite3_create_function(db, "LOG", 1, SQLITE_ANY, 0, logFunc, 0, 0);
   sqlite3_create_function(db, "EXP", 1, SQLITE_ANY, 0, expFunc, 0, 0);
   sqlite3_create_function(db, "POW", 2, SQLITE_ANY, 0, powFunc, 0, 0);
+  sqlite3_create_function(db, "HISTOCONFIG", 1, SQLITE_ANY, 0, histoconfigFunc, 0, 0);
+  sqlite3_create_function(db, "HISTOCONFIG", 2, SQLITE_ANY, 0, histoconfigFunc, 0, 0);
+  sqlite3_create_function(db, "HISTOCACHE", 2, SQLITE_ANY, 0, histocacheFunc, 0, 0);
+  sqlite3_create_function(db, "HISTOCACHE", 3, SQLITE_ANY, 0, histocacheFunc, 0, 0);
 
   sqlite3_create_function(db, "CORREL", 2, SQLITE_ANY, db, NULL, CorrelStep, CorrelFinal);
   sqlite3_create_function(db, "SPEARMANCORREL", 2, SQLITE_ANY, db, NULL, SpCorrelStep, SpCorrelFinal);
+  sqlite3_create_function(db, "HDRPERCENTILE", 2, SQLITE_ANY, 0, NULL, HdrPercentileStep, HdrPercentileFinal);
+  sqlite3_create_function(db, "HDRPERCENTILE", 3, SQLITE_ANY, 0, NULL, HdrPercentileStep, HdrPercentileFinal);
+  // HISTOGRAM is also a window function where SQLite has them, since version 3.25.0
+  if (sqlite3_libversion_number() >= 3025000)
+    sqlite3_create_window_function(db, "HISTOGRAM", 4, SQLITE_ANY, 0, HistogramStep, 
+      HistogramFinal, HistogramValue, HistogramInverse, 0);
+  else
+    sqlite3_create_function(db, "HISTOGRAM", 4, SQLITE_ANY, 0, NULL, HistogramStep, HistogramFinal);
 
 #endif
   return rc;
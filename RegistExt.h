@@ -40,6 +40,8 @@ void sqrtFunc(sqlite3_context *context, int argc, sqlite3_value **argv);
 void logFunc(sqlite3_context *context, int argc, sqlite3_value **argv);
 void expFunc(sqlite3_context *context, int argc, sqlite3_value **argv);
 void powFunc(sqlite3_context *context, int argc, sqlite3_value **argv);
+void histoconfigFunc(sqlite3_context *context, int argc, sqlite3_value **argv);
+void histocacheFunc(sqlite3_context *context, int argc, sqlite3_value **argv);
 
 // aggregate functions
 
@@ -47,6 +49,12 @@ void CorrelStep(sqlite3_context *context, int argc, sqlite3_value **argv);
 void CorrelFinal(sqlite3_context *context);
 void SpCorrelStep(sqlite3_context *context, int argc, sqlite3_value **argv);
 void SpCorrelFinal(sqlite3_context *context);
+void HdrPercentileStep(sqlite3_context *context, int argc, sqlite3_value **argv);
+void HdrPercentileFinal(sqlite3_context *context);
+void HistogramStep(sqlite3_context *context, int argc, sqlite3_value **argv);
+void HistogramFinal(sqlite3_context *context);
+void HistogramValue(sqlite3_context *context);
+void HistogramInverse(sqlite3_context *context, int argc, sqlite3_value **argv);
 
 
 
@@ -132,6 +140,55 @@ int meanhistoBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo);
 
 
 
+extern sqlite3_module histo2dModule;
+
+int histo2dConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+  );
+int histo2dDisconnect(sqlite3_vtab *pVtab);
+int histo2dOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **ppCursor);
+int histo2dClose(sqlite3_vtab_cursor *cur);
+int histo2dNext(sqlite3_vtab_cursor *cur);
+int histo2dColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int i);
+int histo2dRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid);
+int histo2dEof(sqlite3_vtab_cursor *cur);
+int histo2dFilter(
+  sqlite3_vtab_cursor *pVtabCursor,
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+  );
+int histo2dBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo);
+
+
+extern sqlite3_module hdrhistoModule;
+
+int hdrhistoConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+  );
+int hdrhistoDisconnect(sqlite3_vtab *pVtab);
+int hdrhistoOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **ppCursor);
+int hdrhistoClose(sqlite3_vtab_cursor *cur);
+int hdrhistoNext(sqlite3_vtab_cursor *cur);
+int hdrhistoColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int i);
+int hdrhistoRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid);
+int hdrhistoEof(sqlite3_vtab_cursor *cur);
+int hdrhistoFilter(
+  sqlite3_vtab_cursor *pVtabCursor,
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+  );
+int hdrhistoBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo);
+
+
+
 
 #ifdef __cplusplus
 }
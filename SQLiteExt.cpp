@@ -30,8 +30,12 @@ SOFTWARE.
 
 #include "RegistExt.h"
 #include "sqlite3ext.h"
+#include "helpers.h"
 #include <math.h>
+#include <stdio.h>
 #include <vector>
+#include <string>
+#include <new>
 
 
 
@@ -55,6 +59,77 @@ void powFunc(sqlite3_context *context, int argc, sqlite3_value **argv)
   sqlite3_result_double(context, pow(sqlite3_value_double(argv[0]), sqlite3_value_double(argv[1])));
 }
 
+/* HISTOCONFIG('name') returns the value of the named setting of the extension and
+HISTOCONFIG('name', value) changes it, as in SELECT HISTOCONFIG('scanthreads', 8);
+*/
+void histoconfigFunc(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+  const char *name = (const char*)sqlite3_value_text(argv[0]);
+  int minval = 0;
+  int *setting = HistoSetting(name ? name : "", &minval);
+  if (setting == NULL)
+  {
+    sqlite3_result_error(context, "Unknown setting name for HISTOCONFIG", -1);
+    return;
+  }
+  if (argc > 1)
+  {
+    int val = sqlite3_value_int(argv[1]);
+    if (val < minval)
+    {
+      sqlite3_result_error(context, "HISTOCONFIG value is too small for this setting", -1);
+      return;
+    }
+    *setting = val;
+    if (setting == &histoconfig.binkernel) // a level the CPU lacks falls back to a lower one
+      histoconfig.binkernel = SelectBinKernel(val);
+  }
+  sqlite3_result_int(context, *setting);
+}
+
+
+/* HISTOCACHE('tablename', 'columnname') caches the values of a column for HISTO, RATIOHISTO
+and MEANHISTO or brings the cache up to date and returns the number of rows cached.
+HISTOCACHE('tablename', 'columnname', 0) drops the cache of the column.
+*/
+void histocacheFunc(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+  const char *tblname = (const char*)sqlite3_value_text(argv[0]);
+  const char *colid = (const char*)sqlite3_value_text(argv[1]);
+  if (tblname == NULL || colid == NULL)
+  {
+    sqlite3_result_error(context, "HISTOCACHE needs a table name and a column name", -1);
+    return;
+  }
+  sqlite3 *db = sqlite3_context_db_handle(context);
+  // hold the statement cache of db in case no virtual table is connected to it
+  AcquireStmtCache(db);
+  std::string errmsg;
+  sqlite3_int64 nrows = 0;
+  int rc = CheckColumns(db, tblname, { colid }, &errmsg);
+  // the cache and its triggers live in the main database
+  std::string schema, table;
+  SplitTableName(tblname, &schema, &table);
+  if (rc == SQLITE_OK && schema != "" && sqlite3_stricmp(schema.c_str(), "main") != 0)
+  {
+    errmsg = "HISTOCACHE only caches tables of the main database";
+    rc = SQLITE_ERROR;
+  }
+  if (rc == SQLITE_OK && argc > 2 && sqlite3_value_int(argv[2]) == 0)
+    rc = DropCachedColumn(db, table, colid);
+  else if (rc == SQLITE_OK)
+    rc = CacheColumn(db, table, colid, &nrows);
+  if (rc != SQLITE_OK && errmsg == "")
+    errmsg = sqlite3_errmsg(db);
+  ReleaseStmtCache(db);
+  if (rc != SQLITE_OK)
+  {
+    sqlite3_result_error(context, errmsg.c_str(), -1);
+    return;
+  }
+  sqlite3_result_int64(context, nrows);
+}
+
 
 struct StdevCtx 
 {
@@ -213,3 +288,171 @@ void SpCorrelFinal(sqlite3_context *context) {
 
 
 
+
+
+
+/* State of the HISTOGRAM aggregate which is allocated on the first row of a group and freed
+by HistogramFinal
+*/
+struct histogramctx
+{
+  int bins;
+  double minbin, maxbin, binwidth, invwidth;
+  std::vector<sqlite3_int64> counts;
+};
+
+
+static std::string JsonNumber(double x)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.17g", x);
+  return buf;
+}
+
+
+// True for a value that is or converts to an integer or a real number
+static bool IsNumeric(sqlite3_value *val)
+{
+  int type = sqlite3_value_numeric_type(val);
+  return type == SQLITE_INTEGER || type == SQLITE_FLOAT;
+}
+
+
+// Largest number of bins of HISTOGRAM whose counts are returned as a single JSON text
+const sqlite3_int64 MAXHISTOGRAMBINS = 1000000;
+
+
+/* HISTOGRAM(value, nbins, minbin, maxbin) bins the numeric values of a group as they are 
+stepped through by the query so it takes part in joins, GROUP BY and subqueries like any other
+aggregate. The bins are those of HISTO and are fixed by the arguments of the first row.
+No C++ exception may leave the callbacks so running out of memory is returned as an error.
+*/
+void HistogramStep(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+  histogramctx **pp = (histogramctx **)sqlite3_aggregate_context(context, sizeof(*pp));
+  if (pp == NULL)
+  {
+    sqlite3_result_error_nomem(context);
+    return;
+  }
+  if (*pp == NULL)
+  {
+    sqlite3_int64 bins = sqlite3_value_int64(argv[1]);
+    double minbin = sqlite3_value_double(argv[2]);
+    double maxbin = sqlite3_value_double(argv[3]);
+    // checked here rather than with CheckBins which also writes to stderr
+    if (bins < 1 || !isfinite(minbin) || !isfinite(maxbin) || !(minbin < maxbin))
+    {
+      sqlite3_result_error(context, "HISTOGRAM needs nbins > 0 and finite minbin < maxbin", -1);
+      return;
+    }
+    if (bins > MAXHISTOGRAMBINS)
+    {
+      char *msg = sqlite3_mprintf("HISTOGRAM takes at most %lld bins", MAXHISTOGRAMBINS);
+      sqlite3_result_error(context, msg ? msg : "HISTOGRAM has too many bins", -1);
+      sqlite3_free(msg);
+      return;
+    }
+    histogramctx *p = NULL;
+    try
+    {
+      p = new histogramctx;
+      p->counts.assign(bins, 0);
+    }
+    catch (const std::bad_alloc &)
+    {
+      delete p;
+      sqlite3_result_error_nomem(context);
+      return;
+    }
+    p->bins = (int)bins;
+    p->minbin = minbin;
+    p->maxbin = maxbin;
+    p->binwidth = (maxbin - minbin) / bins;
+    p->invwidth = 1.0 / p->binwidth;
+    *pp = p;
+  }
+  if (!IsNumeric(argv[0]))
+    return;
+  histogramctx *p = *pp;
+  int ibin = BinIndex(sqlite3_value_double(argv[0]), p->minbin, p->maxbin, p->binwidth,
+    p->invwidth, p->bins);
+  if (ibin >= 0)
+    p->counts[ibin]++;
+}
+
+
+/* As a window function HISTOGRAM removes the values of the rows leaving the window frame
+from their bins so a sliding window costs one bin update per row entering or leaving it 
+rather than binning every row of the frame again
+*/
+void HistogramInverse(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+  histogramctx **pp = (histogramctx **)sqlite3_aggregate_context(context, 0);
+  if (pp == NULL || *pp == NULL || !IsNumeric(argv[0]))
+    return;
+  histogramctx *p = *pp;
+  int ibin = BinIndex(sqlite3_value_double(argv[0]), p->minbin, p->maxbin, p->binwidth,
+    p->invwidth, p->bins);
+  if (ibin >= 0)
+    p->counts[ibin]--;
+}
+
+
+/* Result of the histogram as the JSON object 
+{"nbins":n,"minbin":min,"maxbin":max,"counts":[c0,c1,...]} or NULL for a group without rows
+*/
+static void HistogramResult(sqlite3_context *context, const histogramctx *p)
+{
+  if (p == NULL)
+  {
+    sqlite3_result_null(context);
+    return;
+  }
+  std::string json = "{\"nbins\":" + std::to_string(p->bins) + ",\"minbin\":" 
+    + JsonNumber(p->minbin) + ",\"maxbin\":" + JsonNumber(p->maxbin) + ",\"counts\":[";
+  for (int i = 0; i < p->bins; i++)
+  {
+    if (i > 0)
+      json += ",";
+    json += std::to_string(p->counts[i]);
+  }
+  json += "]}";
+  sqlite3_result_text(context, json.c_str(), json.size(), SQLITE_TRANSIENT);
+}
+
+
+// The histogram of the current window frame
+void HistogramValue(sqlite3_context *context)
+{
+  histogramctx **pp = (histogramctx **)sqlite3_aggregate_context(context, 0);
+  try
+  {
+    HistogramResult(context, pp ? *pp : NULL);
+  }
+  catch (const std::bad_alloc &)
+  {
+    sqlite3_result_error_nomem(context);
+  }
+}
+
+
+void HistogramFinal(sqlite3_context *context)
+{
+  histogramctx **pp = (histogramctx **)sqlite3_aggregate_context(context, 0);
+  if (pp == NULL)
+  {
+    sqlite3_result_null(context);
+    return;
+  }
+  try
+  {
+    HistogramResult(context, *pp);
+  }
+  catch (const std::bad_alloc &)
+  {
+    sqlite3_result_error_nomem(context);
+  }
+  delete *pp;
+  *pp = NULL;
+}
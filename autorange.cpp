@@ -0,0 +1,179 @@
+/*
+autorange.cpp
+
+Finding the range and number of bins of a histogram from the values binned while the rows
+are held in memory so the table is scanned only once.
+
+The MIT License (MIT)
+
+Copyright (c) 2017 Robert Oeffner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "helpers.h"
+#include "helpers.h"
+#include <algorithm>
+#include <cstring>
+
+
+int ParseBinRule(sqlite3_value *val)
+{
+  if (sqlite3_value_type(val) != SQLITE_TEXT)
+    return BINRULE_NONE;
+  const char *name = (const char*)sqlite3_value_text(val);
+  if (strcmp(name, "fd") == 0 || strcmp(name, "freedman-diaconis") == 0)
+    return BINRULE_FD;
+  if (strcmp(name, "scott") == 0)
+    return BINRULE_SCOTT;
+  if (strcmp(name, "sturges") == 0)
+    return BINRULE_STURGES;
+  return BINRULE_NONE;
+}
+
+
+
+void rowbuffer::Reset(int nthreads)
+{
+  batches.assign(nthreads > 1 ? nthreads : 1, std::vector<columnset>());
+}
+
+
+void rowbuffer::Append(int ithread, const columnset &batch)
+{
+  if (batch.nrows > 0)
+    batches[ithread < 0 ? 0 : ithread].push_back(batch);
+}
+
+
+void rowbuffer::Replay(std::function<void(const columnset &)> accumulate) const
+{
+  for (unsigned t = 0; t < batches.size(); t++)
+  {
+    for (unsigned b = 0; b < batches[t].size(); b++)
+      accumulate(batches[t][b]);
+  }
+}
+
+
+void rowbuffer::FitRange(int ncols, double power, bool findmin, bool findmax, double *minbin,
+                         double *maxbin) const
+{
+  bool positive = power <= 0.0;
+  double minval = INFINITY, maxval = -INFINITY;
+  for (unsigned t = 0; t < batches.size(); t++)
+  {
+    for (unsigned b = 0; b < batches[t].size(); b++)
+    {
+      const columnset &batch = batches[t][b];
+      for (int c = 0; c < ncols; c++)
+      {
+        const double *vals = batch.vals[c].data();
+        const unsigned char *valid = batch.valid[c].data();
+        for (unsigned j = 0; j < batch.nrows; j++)
+        {
+          if (!valid[j] || (positive && !(vals[j] > 0.0)))
+            continue;
+          if (!findmin && vals[j] < *minbin) // only values within a given minbin or maxbin
+            continue;
+          if (!findmax && vals[j] >= *maxbin)
+            continue;
+          minval = std::min(minval, vals[j]);
+          maxval = std::max(maxval, vals[j]);
+        }
+      }
+    }
+  }
+  if (!(minval <= maxval))
+  { // no values so the range is just made valid
+    if (findmin)
+      *minbin = findmax ? (positive ? 1.0 : 0.0) : (positive ? *maxbin / 2.0 : *maxbin - 1.0);
+    if (findmax)
+      *maxbin = positive ? *minbin * 2.0 : *minbin + 1.0;
+    return;
+  }
+  if (minval == maxval && findmin && findmax)
+  { // all values are equal so the range is centred on them as bins of no width cannot be told apart
+    *minbin = positive ? minval / 2.0 : minval - 0.5;
+    *maxbin = positive ? minval * 2.0 : minval + 0.5;
+    return;
+  }
+  if (findmin)
+    *minbin = minval;
+  if (findmax && maxval == *minbin) // likewise when all values equal the given minbin
+    *maxbin = positive ? maxval * 2.0 : maxval + 1.0;
+  else if (findmax)
+    *maxbin = std::nextafter(maxval, INFINITY);
+}
+
+
+int rowbuffer::RuleBins(int rule, int ncols, double minbin, double maxbin, double power) const
+{
+  // the rules apply to the values on the scale of the bins
+  std::vector<double> scaled;
+  double mean = 0.0, M2 = 0.0;
+  for (unsigned t = 0; t < batches.size(); t++)
+  {
+    for (unsigned b = 0; b < batches[t].size(); b++)
+    {
+      const columnset &batch = batches[t][b];
+      for (int c = 0; c < ncols; c++)
+      {
+        for (unsigned j = 0; j < batch.nrows; j++)
+        {
+          double val = batch.vals[c][j];
+          if (!batch.valid[c][j] || !(val >= minbin && val < maxbin))
+            continue;
+          double x = power == 1.0 ? val : ScaleValue(val, power);
+          scaled.push_back(x);
+          double delta = x - mean; // Welford's algorithm as in AccumInterpolations
+          mean += delta / scaled.size();
+          M2 += delta * (x - mean);
+        }
+      }
+    }
+  }
+  double n = (double)scaled.size();
+  double width = 0.0;
+  if (rule == BINRULE_FD && n > 1)
+  {
+    size_t q1 = (size_t)(0.25 * (n - 1)), q3 = (size_t)(0.75 * (n - 1));
+    std::nth_element(scaled.begin(), scaled.begin() + q3, scaled.end());
+    double upper = scaled[q3];
+    std::nth_element(scaled.begin(), scaled.begin() + q1, scaled.begin() + q3);
+    width = 2.0 * (upper - scaled[q1]) / cbrt(n);
+  }
+  else if (rule == BINRULE_SCOTT && n > 1)
+  {
+    width = 3.49 * sqrt(M2 / n) / cbrt(n);
+  }
+  double bins = 0.0;
+  if (width > 0.0)
+  {
+    double range = power == 1.0 ? maxbin - minbin 
+      : fabs(ScaleValue(maxbin, power) - ScaleValue(minbin, power));
+    bins = ceil(range / width);
+  }
+  else
+  { // Sturges' rule, also for values without spread
+    bins = n > 1 ? ceil(log2(n)) + 1 : 1;
+  }
+  return (int)std::min(std::max(bins, 1.0), (double)MAXRULEBINS);
+}
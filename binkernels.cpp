@@ -0,0 +1,514 @@
+/*
+binkernels.cpp
+
+Kernels computing the bin indices of a batch of values with SSE2, AVX2 or AVX-512
+instructions. The kernel used is chosen at load time of the extension from the instruction
+sets supported by the CPU.
+Integer values are binned by kernels specialized at compile time on the width of the
+offsets from minbin, the way they are divided by the bin width and the width of the counters.
+
+The MIT License (MIT)
+
+Copyright (c) 2017 Robert Oeffner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "helpers.h"
+#include <cmath>
+#include <algorithm>
+
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define HISTO_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+/* MSVC compiles intrinsics of any instruction set without special flags whereas gcc and
+clang need a target attribute on the functions using them
+*/
+#if defined(HISTO_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET(isa) __attribute__((target(isa)))
+#else
+#define TARGET(isa)
+#endif
+
+
+
+/* Every kernel performs the operations of BinIndex() on each lane of a vector of values.
+The truncated bin index is held as a double in the lanes while it is corrected and is
+converted to an integer at the end. Lanes with values outside [minbin, maxbin) or NaN get -1.
+*/
+static void BinIndicesScalar(const double *vals, unsigned n, double minbin, double maxbin,
+                             double binwidth, int bins, int *ibins)
+{
+  double invwidth = 1.0 / binwidth;
+  for (unsigned j = 0; j < n; j++)
+    ibins[j] = BinIndex(vals[j], minbin, maxbin, binwidth, invwidth, bins);
+}
+
+
+#ifdef HISTO_X86
+
+TARGET("sse2")
+static void BinIndicesSSE2(const double *vals, unsigned n, double minbin, double maxbin,
+                           double binwidth, int bins, int *ibins)
+{
+  double invwidth = 1.0 / binwidth;
+  const __m128d vmin = _mm_set1_pd(minbin), vmax = _mm_set1_pd(maxbin);
+  const __m128d vwidth = _mm_set1_pd(binwidth), vinv = _mm_set1_pd(invwidth);
+  const __m128d vlast = _mm_set1_pd(bins - 1), vzero = _mm_setzero_pd();
+  const __m128d vone = _mm_set1_pd(1.0), vnone = _mm_set1_pd(-1.0);
+  unsigned j = 0;
+  for (; j + 2 <= n; j += 2)
+  {
+    __m128d v = _mm_loadu_pd(vals + j);
+    __m128d inrange = _mm_and_pd(_mm_cmpge_pd(v, vmin), _mm_cmplt_pd(v, vmax));
+    __m128d diff = _mm_sub_pd(v, vmin);
+    __m128d t = _mm_cvtepi32_pd(_mm_cvttpd_epi32(_mm_mul_pd(diff, vinv)));
+    t = _mm_min_pd(t, vlast);
+    __m128d lower = _mm_and_pd(_mm_cmpgt_pd(t, vzero), _mm_cmplt_pd(diff, _mm_mul_pd(t, vwidth)));
+    __m128d upper = _mm_and_pd(_mm_cmplt_pd(t, vlast),
+      _mm_cmpge_pd(diff, _mm_mul_pd(_mm_add_pd(t, vone), vwidth)));
+    t = _mm_add_pd(_mm_sub_pd(t, _mm_and_pd(lower, vone)), _mm_and_pd(upper, vone));
+    t = _mm_or_pd(_mm_and_pd(inrange, t), _mm_andnot_pd(inrange, vnone));
+    _mm_storel_epi64((__m128i*)(ibins + j), _mm_cvttpd_epi32(t));
+  }
+  BinIndicesScalar(vals + j, n - j, minbin, maxbin, binwidth, bins, ibins + j);
+}
+
+
+TARGET("avx2")
+static void BinIndicesAVX2(const double *vals, unsigned n, double minbin, double maxbin,
+                           double binwidth, int bins, int *ibins)
+{
+  double invwidth = 1.0 / binwidth;
+  const __m256d vmin = _mm256_set1_pd(minbin), vmax = _mm256_set1_pd(maxbin);
+  const __m256d vwidth = _mm256_set1_pd(binwidth), vinv = _mm256_set1_pd(invwidth);
+  const __m256d vlast = _mm256_set1_pd(bins - 1), vzero = _mm256_setzero_pd();
+  const __m256d vone = _mm256_set1_pd(1.0), vnone = _mm256_set1_pd(-1.0);
+  unsigned j = 0;
+  for (; j + 4 <= n; j += 4)
+  {
+    __m256d v = _mm256_loadu_pd(vals + j);
+    __m256d inrange = _mm256_and_pd(_mm256_cmp_pd(v, vmin, _CMP_GE_OQ),
+      _mm256_cmp_pd(v, vmax, _CMP_LT_OQ));
+    __m256d diff = _mm256_sub_pd(v, vmin);
+    __m256d t = _mm256_cvtepi32_pd(_mm256_cvttpd_epi32(_mm256_mul_pd(diff, vinv)));
+    t = _mm256_min_pd(t, vlast);
+    __m256d lower = _mm256_and_pd(_mm256_cmp_pd(t, vzero, _CMP_GT_OQ),
+      _mm256_cmp_pd(diff, _mm256_mul_pd(t, vwidth), _CMP_LT_OQ));
+    __m256d upper = _mm256_and_pd(_mm256_cmp_pd(t, vlast, _CMP_LT_OQ),
+      _mm256_cmp_pd(diff, _mm256_mul_pd(_mm256_add_pd(t, vone), vwidth), _CMP_GE_OQ));
+    t = _mm256_add_pd(_mm256_sub_pd(t, _mm256_and_pd(lower, vone)), _mm256_and_pd(upper, vone));
+    t = _mm256_blendv_pd(vnone, t, inrange);
+    _mm_storeu_si128((__m128i*)(ibins + j), _mm256_cvttpd_epi32(t));
+  }
+  BinIndicesScalar(vals + j, n - j, minbin, maxbin, binwidth, bins, ibins + j);
+}
+
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push // gcc 12 warns of the undefined vectors in its own avx512 headers
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+TARGET("avx512f")
+static void BinIndicesAVX512(const double *vals, unsigned n, double minbin, double maxbin,
+                             double binwidth, int bins, int *ibins)
+{
+  double invwidth = 1.0 / binwidth;
+  const __m512d vmin = _mm512_set1_pd(minbin), vmax = _mm512_set1_pd(maxbin);
+  const __m512d vwidth = _mm512_set1_pd(binwidth), vinv = _mm512_set1_pd(invwidth);
+  const __m512d vlast = _mm512_set1_pd(bins - 1), vzero = _mm512_setzero_pd();
+  const __m512d vone = _mm512_set1_pd(1.0), vnone = _mm512_set1_pd(-1.0);
+  unsigned j = 0;
+  for (; j + 8 <= n; j += 8)
+  {
+    __m512d v = _mm512_loadu_pd(vals + j);
+    __mmask8 inrange = _mm512_cmp_pd_mask(v, vmin, _CMP_GE_OQ)
+      & _mm512_cmp_pd_mask(v, vmax, _CMP_LT_OQ);
+    __m512d diff = _mm512_sub_pd(v, vmin);
+    __m512d t = _mm512_cvtepi32_pd(_mm512_cvttpd_epi32(_mm512_mul_pd(diff, vinv)));
+    t = _mm512_min_pd(t, vlast);
+    __mmask8 lower = _mm512_cmp_pd_mask(t, vzero, _CMP_GT_OQ)
+      & _mm512_cmp_pd_mask(diff, _mm512_mul_pd(t, vwidth), _CMP_LT_OQ);
+    __mmask8 upper = _mm512_cmp_pd_mask(t, vlast, _CMP_LT_OQ)
+      & _mm512_cmp_pd_mask(diff, _mm512_mul_pd(_mm512_add_pd(t, vone), vwidth), _CMP_GE_OQ);
+    t = _mm512_mask_sub_pd(t, lower, t, vone);
+    t = _mm512_mask_add_pd(t, upper, t, vone);
+    t = _mm512_mask_blend_pd(inrange, vnone, t);
+    _mm256_storeu_si256((__m256i*)(ibins + j), _mm512_cvttpd_epi32(t));
+  }
+  BinIndicesScalar(vals + j, n - j, minbin, maxbin, binwidth, bins, ibins + j);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+
+// Highest kernel level supported by the CPU and the operating system
+static int SupportedBinKernel()
+{
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  int maxleaf = info[0];
+  __cpuid(info, 1);
+  bool sse2 = (info[3] & (1 << 26)) != 0;
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+  bool avx2 = false, avx512 = false;
+  if (maxleaf >= 7)
+  {
+    __cpuidex(info, 7, 0);
+    avx2 = (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+    avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xE6) == 0xE6;
+  }
+#else
+  __builtin_cpu_init();
+  bool sse2 = __builtin_cpu_supports("sse2");
+  bool avx2 = __builtin_cpu_supports("avx2");
+  bool avx512 = __builtin_cpu_supports("avx512f");
+#endif
+  if (avx512)
+    return BINKERNEL_AVX512;
+  if (avx2)
+    return BINKERNEL_AVX2;
+  if (sse2)
+    return BINKERNEL_SSE2;
+  return BINKERNEL_SCALAR;
+}
+
+#else
+
+static int SupportedBinKernel()
+{
+  return BINKERNEL_SCALAR;
+}
+
+#endif
+
+
+
+binkernel BinIndices = BinIndicesScalar;
+
+
+int SelectBinKernel(int maxlevel)
+{
+  int level = SupportedBinKernel();
+  if (level > maxlevel)
+    level = maxlevel;
+  BinIndices = BinIndicesScalar;
+#ifdef HISTO_X86
+  if (level == BINKERNEL_SSE2)
+    BinIndices = BinIndicesSSE2;
+  if (level == BINKERNEL_AVX2)
+    BinIndices = BinIndicesAVX2;
+  if (level == BINKERNEL_AVX512)
+    BinIndices = BinIndicesAVX512;
+#endif
+  return level;
+}
+
+
+
+bool IntBinning(double minbin, double maxbin, int bins, intbinning *ib)
+{
+  const double maxexact = 9007199254740992.0; // 2^53, the largest range of exact integers
+  if (bins < 1 || !(minbin < maxbin) || minbin < -maxexact || maxbin > maxexact
+    || floor(minbin) != minbin || floor(maxbin) != maxbin)
+    return false;
+  sqlite3_uint64 range = (sqlite3_uint64)((sqlite3_int64)maxbin - (sqlite3_int64)minbin);
+  if (range % bins != 0)
+    return false;
+  ib->minbin = (sqlite3_int64)minbin;
+  ib->range = range;
+  ib->width = range / bins;
+  ib->wide = range > 0xFFFFFFFFULL;
+  ib->shift = 0;
+  ib->magic = 0;
+  while ((1ULL << ib->shift) < ib->width)
+    ib->shift++;
+  if ((1ULL << ib->shift) == ib->width)
+  {
+    ib->method = INTBIN_SHIFT;
+  }
+  else if (range < 0x80000000ULL)
+  { /* Offsets below 2^31 divided by a width between 2^(l-1) and 2^l equal the offset times
+    magic = floor(2^(31+l) / width) + 1 shifted right by 31+l bits. The product fits in 
+    64 bits as magic is at most 2^32. See Granlund and Montgomery, Division by Invariant
+    Integers using Multiplication, PLDI 1994.
+    */
+    ib->method = INTBIN_MULHI;
+    ib->magic = (1ULL << (31 + ib->shift)) / ib->width + 1;
+    ib->shift += 31;
+  }
+  else
+  {
+    ib->method = INTBIN_DIVIDE;
+  }
+  return true;
+}
+
+
+/* The quotient of an offset and the bin width. Diff is the unsigned type holding offsets,
+32 bits wide unless the range of the bins needs 64 bits.
+*/
+template<typename Diff, int METHOD> struct binquotient;
+
+template<typename Diff> struct binquotient<Diff, INTBIN_SHIFT>
+{
+  static Diff Of(Diff diff, const intbinning &ib) { return diff >> ib.shift; }
+};
+
+template<typename Diff> struct binquotient<Diff, INTBIN_MULHI>
+{
+  static Diff Of(Diff diff, const intbinning &ib)
+  {
+    return (Diff)(((sqlite3_uint64)diff * ib.magic) >> ib.shift);
+  }
+};
+
+template<typename Diff> struct binquotient<Diff, INTBIN_DIVIDE>
+{
+  static Diff Of(Diff diff, const intbinning &ib) { return diff / (Diff)ib.width; }
+};
+
+
+/* The offset from minbin is computed with unsigned wraparound so that a single comparison
+with the range rejects values both below minbin and at or above maxbin
+*/
+template<typename Diff, int METHOD>
+static void IntBinIndicesT(const intbinning &ib, const sqlite3_int64 *vals, unsigned n, int *ibins)
+{
+  for (unsigned j = 0; j < n; j++)
+  {
+    sqlite3_uint64 diff = (sqlite3_uint64)vals[j] - (sqlite3_uint64)ib.minbin;
+    ibins[j] = diff < ib.range ? (int)binquotient<Diff, METHOD>::Of((Diff)diff, ib) : -1;
+  }
+}
+
+
+/* Counts are kept in Counter, an unsigned type just wide enough for the number of values,
+so the counters of many bins stay in the cache
+*/
+template<typename Diff, int METHOD, typename Counter>
+static void CountIntBinsT(const intbinning &ib, const sqlite3_int64 *vals,
+                          const unsigned char *valid, unsigned n, Counter *counts)
+{
+  for (unsigned j = 0; j < n; j++)
+  {
+    sqlite3_uint64 diff = (sqlite3_uint64)vals[j] - (sqlite3_uint64)ib.minbin;
+    if (valid[j] && diff < ib.range)
+      counts[binquotient<Diff, METHOD>::Of((Diff)diff, ib)]++;
+  }
+}
+
+
+void IntBinIndices(const intbinning &ib, const sqlite3_int64 *vals, unsigned n, int *ibins)
+{
+  if (ib.method == INTBIN_SHIFT && ib.wide)
+    IntBinIndicesT<sqlite3_uint64, INTBIN_SHIFT>(ib, vals, n, ibins);
+  else if (ib.method == INTBIN_SHIFT)
+    IntBinIndicesT<unsigned, INTBIN_SHIFT>(ib, vals, n, ibins);
+  else if (ib.method == INTBIN_MULHI)
+    IntBinIndicesT<unsigned, INTBIN_MULHI>(ib, vals, n, ibins);
+  else if (ib.wide)
+    IntBinIndicesT<sqlite3_uint64, INTBIN_DIVIDE>(ib, vals, n, ibins);
+  else
+    IntBinIndicesT<unsigned, INTBIN_DIVIDE>(ib, vals, n, ibins);
+}
+
+
+template<typename Counter>
+static void CountIntBinsAs(const intbinning &ib, const sqlite3_int64 *vals,
+                           const unsigned char *valid, unsigned n, int bins, histobin *histo)
+{
+  static thread_local std::vector<Counter> counts;
+  counts.assign(bins, 0);
+  if (ib.method == INTBIN_SHIFT && ib.wide)
+    CountIntBinsT<sqlite3_uint64, INTBIN_SHIFT>(ib, vals, valid, n, counts.data());
+  else if (ib.method == INTBIN_SHIFT)
+    CountIntBinsT<unsigned, INTBIN_SHIFT>(ib, vals, valid, n, counts.data());
+  else if (ib.method == INTBIN_MULHI)
+    CountIntBinsT<unsigned, INTBIN_MULHI>(ib, vals, valid, n, counts.data());
+  else if (ib.wide)
+    CountIntBinsT<sqlite3_uint64, INTBIN_DIVIDE>(ib, vals, valid, n, counts.data());
+  else
+    CountIntBinsT<unsigned, INTBIN_DIVIDE>(ib, vals, valid, n, counts.data());
+  for (int i = 0; i < bins; i++)
+    histo[i].count += counts[i];
+}
+
+
+void CountIntBins(const intbinning &ib, const sqlite3_int64 *vals, const unsigned char *valid,
+                  unsigned n, int bins, histobin *histo)
+{
+  if (n <= 0xFFFF)
+    CountIntBinsAs<unsigned short>(ib, vals, valid, n, bins, histo);
+  else
+    CountIntBinsAs<unsigned>(ib, vals, valid, n, bins, histo);
+}
+
+
+
+// Bits of a double which are ordered as the values are for positive doubles
+static sqlite3_uint64 DoubleBits(double val)
+{
+  sqlite3_uint64 bits;
+  memcpy(&bits, &val, sizeof(bits));
+  return bits;
+}
+
+
+static double BitsDouble(sqlite3_uint64 bits)
+{
+  double val;
+  memcpy(&val, &bits, sizeof(val));
+  return val;
+}
+
+
+int SetBinEdges(binedges &be, const std::vector<double> &edges, std::string *errmsg)
+{
+  if (edges.size() < 2)
+  {
+    *errmsg = "at least two bin edges are needed";
+    return SQLITE_ERROR;
+  }
+  double minwidth = INFINITY, minrelwidth = INFINITY;
+  for (size_t i = 0; i < edges.size(); i++)
+  {
+    if (!std::isfinite(edges[i]) || (i > 0 && !(edges[i] > edges[i - 1])))
+    {
+      *errmsg = "bin edges must be finite numbers in strictly ascending order";
+      return SQLITE_ERROR;
+    }
+    if (i == 0)
+      continue;
+    minwidth = std::min(minwidth, edges[i] - edges[i - 1]);
+    minrelwidth = std::min(minrelwidth, (edges[i] - edges[i - 1]) / edges[i]);
+  }
+  be.edges = edges;
+  int bins = be.bins();
+  be.centers.resize(bins);
+  for (int i = 0; i < bins; i++)
+    be.centers[i] = 0.5 * (edges[i] + edges[i + 1]);
+  double range = edges.back() - edges.front();
+  double ncells = std::max(ceil(range / minwidth), (double)bins);
+  be.cellshift = 0;
+  be.firstcell = 0;
+  if (ncells > MAXEDGECELLS && edges.front() > 0.0)
+  { /* A cell of the exponent and k leading mantissa bits is at most 2^-k of its values wide
+    so k is chosen for the cells to be no wider than the narrowest bin relative to its values
+    while keeping to MAXEDGECELLS cells
+    */
+    int mantbits = std::min(52, (int)ceil(-log2(minrelwidth)));
+    while (mantbits > 0 && (DoubleBits(edges.back()) >> (52 - mantbits))
+      - (DoubleBits(edges.front()) >> (52 - mantbits)) >= (sqlite3_uint64)MAXEDGECELLS)
+      mantbits--;
+    be.cellshift = 52 - mantbits;
+    be.firstcell = DoubleBits(edges.front()) >> be.cellshift;
+    ncells = (double)((DoubleBits(edges.back()) >> be.cellshift) - be.firstcell + 1);
+  }
+  else if (ncells > MAXEDGECELLS)
+  {
+    ncells = MAXEDGECELLS;
+  }
+  be.invcellwidth = ncells / range;
+  be.lookup.resize((size_t)ncells);
+  int ibin = 0;
+  for (size_t c = 0; c < be.lookup.size(); c++)
+  { // the cells and edges both ascend so the bin of each cell follows on from the last
+    double lower = edges.front() + c / be.invcellwidth;
+    if (be.cellshift > 0)
+      lower = BitsDouble((be.firstcell + c) << be.cellshift);
+    while (ibin < bins - 1 && lower >= edges[ibin + 1])
+      ibin++;
+    be.lookup[c] = ibin;
+  }
+  return SQLITE_OK;
+}
+
+
+int ScaledBinEdges(binedges &be, int bins, double minbin, double maxbin, double power,
+                   std::string *errmsg)
+{
+  if (!(minbin > 0.0 || (power > 0.0 && minbin == 0.0)))
+  {
+    *errmsg = power == 0.0 ? "minbin must be positive for logarithmic bins"
+      : "minbin must be positive for bins of a power scale, or 0 for a positive power";
+    return SQLITE_ERROR;
+  }
+  double tmin = ScaleValue(minbin, power), tmax = ScaleValue(maxbin, power);
+  std::vector<double> edges(bins + 1);
+  for (int i = 0; i <= bins; i++)
+    edges[i] = UnscaleValue(tmin + (tmax - tmin) * i / bins, power);
+  edges[0] = minbin; // exactly as given rather than rounded through the scale
+  edges[bins] = maxbin;
+  int rc = SetBinEdges(be, edges, errmsg);
+  if (rc != SQLITE_OK)
+  {
+    *errmsg = "too many bins to tell their edges apart on this scale";
+    return rc;
+  }
+  for (int i = 0; i < bins; i++)
+    be.centers[i] = UnscaleValue(0.5 * (ScaleValue(edges[i], power) 
+      + ScaleValue(edges[i + 1], power)), power);
+  return SQLITE_OK;
+}
+
+
+void EdgeBinIndices(const binedges &be, const double *vals, unsigned n, int *ibins)
+{
+  const double *edges = be.edges.data();
+  const int *lookup = be.lookup.data();
+  int bins = be.bins();
+  int lastcell = (int)be.lookup.size() - 1;
+  double minbin = edges[0], maxbin = edges[bins];
+  for (unsigned j = 0; j < n; j++)
+  {
+    double val = vals[j];
+    if (!(val >= minbin && val < maxbin))
+    {
+      ibins[j] = -1;
+      continue;
+    }
+    int cell;
+    if (be.cellshift > 0)
+      cell = (int)((DoubleBits(val) >> be.cellshift) - be.firstcell);
+    else
+      cell = (int)((val - minbin) * be.invcellwidth);
+    if (cell > lastcell)
+      cell = lastcell;
+    /* The rounded cell of a value next to a cell boundary may be one off so the edges are
+    searched both ways from the bin of the cell
+    */
+    int ibin = lookup[cell];
+    while (ibin > 0 && val < edges[ibin])
+      ibin--;
+    while (ibin < bins - 1 && val >= edges[ibin + 1])
+      ibin++;
+    ibins[j] = ibin;
+  }
+}
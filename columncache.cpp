@@ -0,0 +1,452 @@
+/*
+columncache.cpp
+
+Opt-in columnar cache of numeric columns. The values of a cached column are stored as
+packed blocks of doubles in a shadow table and are read back with incremental blob I/O
+instead of walking and decoding the rows of the table.
+
+The MIT License (MIT)
+
+Copyright (c) 2017 Robert Oeffner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "helpers.h"
+
+
+/* The cache lives in two shadow tables of the main database. histocache_columns has a row
+for every cached column telling the largest rowid and the number of rows cached and whether
+the cache is still valid. histocache_blocks holds the values of the rows of a column in
+rowid order as blocks of CACHEBLOCKROWS doubles in native byte order. A NULL value is
+stored as NaN which SQLite never stores as a number. So are TEXT and BLOB values since the
+range clause of a table scan leaves them out of the bins as well.
+Triggers on the table mark the cache of its columns as invalid on any UPDATE, DELETE or
+INSERT below the largest cached rowid. Reading the cache never writes to the database: it is
+only used if it is valid and the largest rowid of the table is still the largest cached
+rowid, or else the table is scanned. HISTOCACHE() folds the rows appended since into the
+last blocks or builds the blocks again from scratch if the cache is invalid. The rowid stamp
+also catches INSERT OR REPLACE deleting rows on a conflict of another unique key, which
+fires no DELETE trigger unless recursive_triggers is on, as the replacing row is appended.
+*/
+const unsigned CACHEBLOCKROWS = BATCHSIZE;
+// Number of rows of cached blocks passed on for binning at a time
+const unsigned CACHEBATCHROWS = 32 * CACHEBLOCKROWS;
+
+static const char *cacheschema =
+  "CREATE TABLE IF NOT EXISTS histocache_columns(tblname TEXT, colid TEXT, "
+  "maxrowid INTEGER, nrows INTEGER, valid INTEGER, PRIMARY KEY(tblname, colid));"
+  "CREATE TABLE IF NOT EXISTS histocache_blocks(tblname TEXT, colid TEXT, "
+  "blockno INTEGER, nrows INTEGER, vals BLOB, UNIQUE(tblname, colid, blockno));";
+
+
+
+// Step a statement without result rows and finalize it
+static int ExecStmt(sqlite3_stmt *stmt)
+{
+  int rc = sqlite3_step(stmt);
+  int frc = sqlite3_finalize(stmt);
+  return rc == SQLITE_DONE ? frc : rc;
+}
+
+
+static int ExecFormatted(sqlite3 *db, char *sql)
+{
+  if (sql == NULL)
+    return SQLITE_NOMEM;
+  int rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+  sqlite3_free(sql);
+  return rc;
+}
+
+
+static int PrepareKeyed(sqlite3 *db, const char *sql, std::string tblname, std::string colid,
+                        sqlite3_stmt **stmt)
+{
+  int rc = sqlite3_prepare_v2(db, sql, -1, stmt, NULL);
+  if (rc == SQLITE_OK)
+    rc = sqlite3_bind_text(*stmt, 1, tblname.c_str(), -1, SQLITE_TRANSIENT);
+  if (rc == SQLITE_OK)
+    rc = sqlite3_bind_text(*stmt, 2, colid.c_str(), -1, SQLITE_TRANSIENT);
+  return rc;
+}
+
+
+// Execute sql without result rows with tblname and colid bound to ?1 and ?2
+static int ExecKeyed(sqlite3 *db, const char *sql, std::string tblname, std::string colid)
+{
+  sqlite3_stmt *stmt = NULL;
+  int rc = PrepareKeyed(db, sql, tblname, colid, &stmt);
+  if (rc != SQLITE_OK)
+  {
+    sqlite3_finalize(stmt);
+    return rc;
+  }
+  return ExecStmt(stmt);
+}
+
+
+// True if the triggers invalidating the cache of the columns of tblname exist
+static bool HasCacheTriggers(sqlite3 *db, std::string tblname)
+{
+  char *sql = sqlite3_mprintf("SELECT count(*) FROM sqlite_master WHERE type = 'trigger' "
+    "AND name IN ('histocache_%q_insert', 'histocache_%q_update', 'histocache_%q_delete')",
+    tblname.c_str(), tblname.c_str(), tblname.c_str());
+  sqlite3_stmt *stmt = NULL;
+  int ntriggers = 0;
+  if (sql != NULL && sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK
+    && sqlite3_step(stmt) == SQLITE_ROW)
+    ntriggers = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+  sqlite3_free(sql);
+  return ntriggers == 3;
+}
+
+
+static int CreateCacheTriggers(sqlite3 *db, std::string tblname)
+{
+  const char *t = tblname.c_str();
+  return ExecFormatted(db, sqlite3_mprintf(
+    "CREATE TRIGGER IF NOT EXISTS \"histocache_%w_insert\" AFTER INSERT ON \"%w\" BEGIN "
+    "UPDATE histocache_columns SET valid = 0 WHERE tblname = '%q' AND valid AND NEW.rowid <= maxrowid; END;"
+    "CREATE TRIGGER IF NOT EXISTS \"histocache_%w_update\" AFTER UPDATE ON \"%w\" BEGIN "
+    "UPDATE histocache_columns SET valid = 0 WHERE tblname = '%q' AND valid; END;"
+    "CREATE TRIGGER IF NOT EXISTS \"histocache_%w_delete\" AFTER DELETE ON \"%w\" BEGIN "
+    "UPDATE histocache_columns SET valid = 0 WHERE tblname = '%q' AND valid; END;",
+    t, t, t, t, t, t, t, t, t));
+}
+
+
+static int WriteBlock(sqlite3 *db, std::string tblname, std::string colid,
+                      sqlite3_int64 blockno, const std::vector<double> &vals)
+{
+  sqlite3_stmt *stmt = NULL;
+  int rc = PrepareKeyed(db, "INSERT OR REPLACE INTO histocache_blocks"
+    "(tblname, colid, blockno, nrows, vals) VALUES (?1, ?2, ?3, ?4, ?5)", tblname, colid, &stmt);
+  if (rc == SQLITE_OK)
+    rc = sqlite3_bind_int64(stmt, 3, blockno);
+  if (rc == SQLITE_OK)
+    rc = sqlite3_bind_int64(stmt, 4, vals.size());
+  if (rc == SQLITE_OK)
+    rc = sqlite3_bind_blob(stmt, 5, vals.data(), vals.size() * sizeof(double), SQLITE_STATIC);
+  if (rc != SQLITE_OK)
+  {
+    sqlite3_finalize(stmt);
+    return rc;
+  }
+  return ExecStmt(stmt);
+}
+
+
+// Read the values of a block of nrows rows into vals starting at vals[offset]
+static int ReadBlock(sqlite3 *db, sqlite3_blob **blob, sqlite3_int64 blockrowid,
+                     std::vector<double> &vals, unsigned offset, unsigned nrows)
+{
+  int rc = SQLITE_OK;
+  if (*blob == NULL)
+    rc = sqlite3_blob_open(db, "main", "histocache_blocks", "vals", blockrowid, 0, blob);
+  else
+    rc = sqlite3_blob_reopen(*blob, blockrowid);
+  if (rc != SQLITE_OK)
+    return rc;
+  if ((unsigned)sqlite3_blob_bytes(*blob) < nrows * sizeof(double))
+    return SQLITE_CORRUPT;
+  vals.resize(offset + nrows);
+  return sqlite3_blob_read(*blob, vals.data() + offset, nrows * sizeof(double), 0);
+}
+
+
+/* Bring the cache of colid up to date with tblname. The blocks are built from scratch if
+the cache is invalid or else the rows appended since the cache was last refreshed are
+folded into the last blocks. The number of rows cached is returned in nrows.
+*/
+static int RefreshColumn(sqlite3 *db, std::string tblname, std::string colid,
+                         sqlite3_int64 *nrows)
+{
+  sqlite3_stmt *stmt = NULL;
+  int rc = PrepareKeyed(db, "SELECT maxrowid, nrows, valid FROM histocache_columns "
+    "WHERE tblname = ?1 AND colid = ?2", tblname, colid, &stmt);
+  if (rc != SQLITE_OK)
+  {
+    sqlite3_finalize(stmt);
+    return rc;
+  }
+  bool cached = sqlite3_step(stmt) == SQLITE_ROW;
+  sqlite3_int64 maxrowid = cached ? sqlite3_column_int64(stmt, 0) : 0;
+  *nrows = cached ? sqlite3_column_int64(stmt, 1) : 0;
+  bool valid = cached && sqlite3_column_int(stmt, 2) != 0;
+  sqlite3_finalize(stmt);
+
+  // dropping and creating the table again also drops the triggers
+  if (!HasCacheTriggers(db, tblname))
+  {
+    valid = false;
+    rc = CreateCacheTriggers(db, tblname);
+    if (rc != SQLITE_OK)
+      return rc;
+  }
+  if (valid)
+  { // rows deleted by INSERT OR REPLACE fire no trigger so count the cached rows still there
+    std::string s_count = "SELECT count(*) FROM " + QuoteId(tblname) + " WHERE rowid <= ?1";
+    rc = sqlite3_prepare_v2(db, s_count.c_str(), -1, &stmt, NULL);
+    if (rc == SQLITE_OK)
+      rc = sqlite3_bind_int64(stmt, 1, maxrowid);
+    if (rc == SQLITE_OK)
+      rc = sqlite3_step(stmt) == SQLITE_ROW ? SQLITE_OK : sqlite3_errcode(db);
+    if (rc == SQLITE_OK && sqlite3_column_int64(stmt, 0) != *nrows)
+      valid = false;
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_OK)
+      return rc;
+  }
+  if (!valid)
+  {
+    *nrows = 0;
+    rc = ExecKeyed(db, "DELETE FROM histocache_blocks WHERE tblname = ?1 AND colid = ?2",
+      tblname, colid);
+    if (rc != SQLITE_OK)
+      return rc;
+  }
+
+  // read the rows after the last cached row in rowid order
+  std::string s_exe = "SELECT rowid, " + QuoteId(colid) + " FROM " + QuoteId(tblname);
+  if (*nrows > 0)
+    s_exe += " WHERE rowid > ?1";
+  s_exe += " ORDER BY rowid";
+  sqlite3_stmt *tail = NULL;
+  rc = sqlite3_prepare_v2(db, s_exe.c_str(), -1, &tail, NULL);
+  if (rc == SQLITE_OK && *nrows > 0)
+    rc = sqlite3_bind_int64(tail, 1, maxrowid);
+  if (rc != SQLITE_OK)
+  {
+    sqlite3_finalize(tail);
+    return rc;
+  }
+
+  std::vector<double> block;
+  sqlite3_int64 blockno = *nrows / CACHEBLOCKROWS;
+  bool lastblockread = *nrows % CACHEBLOCKROWS == 0;
+  sqlite3_int64 newrows = 0;
+  while ((rc = sqlite3_step(tail)) == SQLITE_ROW)
+  {
+    if (!lastblockread)
+    { // start from the values of the last block which is not full yet
+      sqlite3_stmt *last = NULL;
+      rc = PrepareKeyed(db, "SELECT rowid FROM histocache_blocks "
+        "WHERE tblname = ?1 AND colid = ?2 AND blockno = ?3", tblname, colid, &last);
+      if (rc == SQLITE_OK)
+        rc = sqlite3_bind_int64(last, 3, blockno);
+      if (rc == SQLITE_OK)
+        rc = sqlite3_step(last) == SQLITE_ROW ? SQLITE_OK : SQLITE_CORRUPT;
+      sqlite3_blob *blob = NULL;
+      if (rc == SQLITE_OK)
+        rc = ReadBlock(db, &blob, sqlite3_column_int64(last, 0), block, 0,
+          *nrows % CACHEBLOCKROWS);
+      sqlite3_blob_close(blob);
+      sqlite3_finalize(last);
+      if (rc != SQLITE_OK)
+        break;
+      lastblockread = true;
+    }
+    maxrowid = sqlite3_column_int64(tail, 0);
+    int type = sqlite3_column_type(tail, 1);
+    block.push_back(type == SQLITE_INTEGER || type == SQLITE_FLOAT ? sqlite3_column_double(tail, 1) : NAN);
+    newrows++;
+    if (block.size() == CACHEBLOCKROWS)
+    {
+      rc = WriteBlock(db, tblname, colid, blockno++, block);
+      if (rc != SQLITE_OK)
+        break;
+      block.clear();
+    }
+  }
+  sqlite3_finalize(tail);
+  if (rc == SQLITE_DONE)
+    rc = SQLITE_OK;
+  if (rc == SQLITE_OK && block.size() > 0)
+    rc = WriteBlock(db, tblname, colid, blockno, block);
+  if (rc != SQLITE_OK)
+    return rc;
+  if (valid && newrows == 0)
+    return SQLITE_OK; // nothing changed
+
+  *nrows += newrows;
+  rc = PrepareKeyed(db, "INSERT OR REPLACE INTO histocache_columns"
+    "(tblname, colid, maxrowid, nrows, valid) VALUES (?1, ?2, ?3, ?4, 1)", tblname, colid, &stmt);
+  if (rc == SQLITE_OK)
+    rc = sqlite3_bind_int64(stmt, 3, maxrowid);
+  if (rc == SQLITE_OK)
+    rc = sqlite3_bind_int64(stmt, 4, *nrows);
+  if (rc != SQLITE_OK)
+  {
+    sqlite3_finalize(stmt);
+    return rc;
+  }
+  return ExecStmt(stmt);
+}
+
+
+int CacheColumn(sqlite3 *db, std::string tblname, std::string colid, sqlite3_int64 *nrows)
+{
+  int rc = sqlite3_exec(db, "SAVEPOINT histocache;", NULL, NULL, NULL);
+  if (rc == SQLITE_OK)
+    rc = sqlite3_exec(db, cacheschema, NULL, NULL, NULL);
+  if (rc == SQLITE_OK)
+    rc = RefreshColumn(db, tblname, colid, nrows);
+  if (rc != SQLITE_OK)
+    sqlite3_exec(db, "ROLLBACK TO histocache;", NULL, NULL, NULL);
+  sqlite3_exec(db, "RELEASE histocache;", NULL, NULL, NULL);
+  return rc;
+}
+
+
+int DropCachedColumn(sqlite3 *db, std::string tblname, std::string colid)
+{
+  int rc = sqlite3_exec(db, "SAVEPOINT histocache;", NULL, NULL, NULL);
+  if (rc == SQLITE_OK)
+    rc = sqlite3_exec(db, cacheschema, NULL, NULL, NULL);
+  if (rc == SQLITE_OK)
+    rc = ExecKeyed(db, "DELETE FROM histocache_blocks WHERE tblname = ?1 AND colid = ?2",
+      tblname, colid);
+  if (rc == SQLITE_OK)
+    rc = ExecKeyed(db, "DELETE FROM histocache_columns WHERE tblname = ?1 AND colid = ?2",
+      tblname, colid);
+  if (rc == SQLITE_OK)
+  { // the triggers are no longer needed once no column of the table is cached
+    const char *t = tblname.c_str();
+    char *sql = sqlite3_mprintf("SELECT count(*) FROM histocache_columns WHERE tblname = '%q'", t);
+    sqlite3_stmt *count = NULL;
+    if (sql != NULL && sqlite3_prepare_v2(db, sql, -1, &count, NULL) == SQLITE_OK
+      && sqlite3_step(count) == SQLITE_ROW && sqlite3_column_int(count, 0) == 0)
+    {
+      rc = ExecFormatted(db, sqlite3_mprintf(
+        "DROP TRIGGER IF EXISTS \"histocache_%w_insert\";"
+        "DROP TRIGGER IF EXISTS \"histocache_%w_update\";"
+        "DROP TRIGGER IF EXISTS \"histocache_%w_delete\";", t, t, t));
+    }
+    sqlite3_finalize(count);
+    sqlite3_free(sql);
+  }
+  if (rc != SQLITE_OK)
+    sqlite3_exec(db, "ROLLBACK TO histocache;", NULL, NULL, NULL);
+  sqlite3_exec(db, "RELEASE histocache;", NULL, NULL, NULL);
+  return rc;
+}
+
+
+bool ColumnCacheReady(sqlite3 *db, std::string tblname, const std::vector<std::string> &colids,
+                      sqlite3_int64 *nrows)
+{
+  // most tables are not cached so look that up with a cached statement before anything else
+  int rc = SQLITE_OK;
+  sqlite3_stmt *stmt = GetCachedStmt(db, "SELECT 1 FROM sqlite_master "
+    "WHERE type = 'table' AND name = 'histocache_columns'", &rc);
+  bool hascache = rc == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW;
+  if (rc == SQLITE_OK)
+    sqlite3_reset(stmt);
+  if (!hascache || !HasCacheTriggers(db, tblname))
+    return false;
+  sqlite3_int64 minrowid = 0, maxrowid = 0;
+  bool empty = true;
+  if (RowidRange(db, QuoteId(tblname), &minrowid, &maxrowid, &empty) != SQLITE_OK)
+    return false;
+
+  // only read here as this runs in the middle of a query; HISTOCACHE() brings stale caches up to date
+  for (unsigned c = 0; c < colids.size(); c++)
+  {
+    sqlite3_stmt *col = NULL;
+    rc = PrepareKeyed(db, "SELECT maxrowid, nrows, valid FROM histocache_columns "
+      "WHERE tblname = ?1 AND colid = ?2", tblname, colids[c], &col);
+    bool current = rc == SQLITE_OK && sqlite3_step(col) == SQLITE_ROW
+      && sqlite3_column_int(col, 2) != 0
+      && sqlite3_column_int64(col, 0) == (empty ? 0 : maxrowid)
+      && (c == 0 || sqlite3_column_int64(col, 1) == *nrows);
+    if (current)
+      *nrows = sqlite3_column_int64(col, 1);
+    sqlite3_finalize(col);
+    if (!current)
+      return false;
+  }
+  return true;
+}
+
+
+int CachedReadBatches(sqlite3 *db, std::string tblname, const std::vector<std::string> &colids,
+                      sqlite3_int64 nrows, std::function<void(const columnset &)> accumulate)
+{
+  int rc = SQLITE_OK;
+  int ncols = colids.size();
+  // rowids of the blocks of every column in the shadow table
+  std::vector< std::vector<sqlite3_int64> > blockrowids(ncols);
+  sqlite3_int64 nblocks = (nrows + CACHEBLOCKROWS - 1) / CACHEBLOCKROWS;
+  for (int c = 0; c < ncols && rc == SQLITE_OK; c++)
+  {
+    sqlite3_stmt *stmt = NULL;
+    rc = PrepareKeyed(db, "SELECT rowid FROM histocache_blocks WHERE tblname = ?1 "
+      "AND colid = ?2 ORDER BY blockno", tblname, colids[c], &stmt);
+    while (rc == SQLITE_OK && (sqlite3_int64)blockrowids[c].size() < nblocks
+      && sqlite3_step(stmt) == SQLITE_ROW)
+      blockrowids[c].push_back(sqlite3_column_int64(stmt, 0));
+    sqlite3_finalize(stmt);
+    if (rc == SQLITE_OK && (sqlite3_int64)blockrowids[c].size() < nblocks)
+      rc = SQLITE_CORRUPT;
+  }
+  if (rc != SQLITE_OK)
+    return rc;
+
+  std::vector<sqlite3_blob*> blobs(ncols, (sqlite3_blob*)NULL);
+  columnset batch(ncols);
+  for (sqlite3_int64 b = 0; b < nblocks && rc == SQLITE_OK; b++)
+  {
+    sqlite3_int64 remaining = nrows - b * CACHEBLOCKROWS;
+    unsigned blockrows = remaining < CACHEBLOCKROWS ? (unsigned)remaining : CACHEBLOCKROWS;
+    unsigned offset = batch.nrows;
+    for (int c = 0; c < ncols && rc == SQLITE_OK; c++)
+    {
+      rc = ReadBlock(db, &blobs[c], blockrowids[c][b], batch.vals[c], offset, blockrows);
+      batch.valid[c].resize(offset + blockrows);
+      for (unsigned j = offset; j < offset + blockrows && rc == SQLITE_OK; j++)
+      {
+        batch.valid[c][j] = !isnan(batch.vals[c][j]);
+        if (!batch.valid[c][j])
+          batch.vals[c][j] = 0.0;
+      }
+    }
+    batch.nrows += blockrows;
+    // pass on several blocks at a time so that large batches can be binned in parallel
+    if (rc == SQLITE_OK && (batch.nrows >= CACHEBATCHROWS || b == nblocks - 1))
+    {
+      accumulate(batch);
+      batch.Clear();
+    }
+  }
+  for (int c = 0; c < ncols; c++)
+    sqlite3_blob_close(blobs[c]);
+  return rc;
+}
+
+
+std::string ColumnCachePlan(std::string tblname, const std::vector<std::string> &colids)
+{
+  std::string plan = "SCAN COLUMN CACHE OF " + tblname + " (";
+  for (unsigned c = 0; c < colids.size(); c++)
+    plan += (c > 0 ? ", " : "") + colids[c];
+  return plan + ")";
+}
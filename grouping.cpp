@@ -0,0 +1,180 @@
+/*
+grouping.cpp
+
+Histograms for each distinct value of a group column computed in a single scan of a table.
+
+The MIT License (MIT)
+
+Copyright (c) 2017 Robert Oeffner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "helpers.h"
+#include <algorithm>
+
+
+// Numbers are compared by value so 3 and 3.0 are the same group as in GROUP BY
+static int KeyClass(int type)
+{
+  return type == SQLITE_FLOAT ? SQLITE_INTEGER : type;
+}
+
+
+bool groupkey::operator==(const groupkey &other) const
+{
+  if (KeyClass(type) != KeyClass(other.type))
+    return false;
+  if (type == SQLITE_TEXT)
+    return text == other.text;
+  return num == other.num;
+}
+
+
+bool groupkey::operator<(const groupkey &other) const
+{
+  int order = KeyClass(type) == SQLITE_NULL ? 0 : (KeyClass(type) == SQLITE_INTEGER ? 1 : 2);
+  int otherorder = KeyClass(other.type) == SQLITE_NULL ? 0 
+    : (KeyClass(other.type) == SQLITE_INTEGER ? 1 : 2);
+  if (order != otherorder)
+    return order < otherorder;
+  if (order == 2)
+    return text < other.text;
+  return num < other.num;
+}
+
+
+size_t groupkeyhash::operator()(const groupkey &key) const
+{
+  if (key.type == SQLITE_TEXT)
+    return std::hash<std::string>()(key.text);
+  if (key.type == SQLITE_NULL)
+    return 0;
+  return std::hash<double>()(key.num + 0.0); // adding 0.0 turns -0.0 into 0.0
+}
+
+
+
+void grouphistograms::Reset(int ncols_, int bins_, double minbin_, double maxbin_,
+                            const binedges *edges_)
+{
+  ncols = ncols_;
+  bins = bins_;
+  minbin = minbin_;
+  maxbin = maxbin_;
+  edges = edges_;
+  keys.clear();
+  groupindex.clear();
+  counts.clear();
+}
+
+
+// Index of the group of key which is added with zero counts if it is new
+int grouphistograms::Group(const groupkey &key)
+{
+  auto found = groupindex.emplace(key, (int)keys.size());
+  if (found.second)
+  {
+    keys.push_back(key);
+    counts.resize(counts.size() + (size_t)ncols * bins, 0);
+  }
+  return found.first->second;
+}
+
+
+void grouphistograms::Accum(const columnset &batch, int groupcol)
+{
+  /* Find the counters of the group of each row. The groups of the texts of the batch are
+  looked up once per distinct text and runs of the same number once per run.
+  */
+  offsets.resize(batch.nrows);
+  textgroups.assign(batch.texts[groupcol].size(), -1);
+  const double *vals = batch.vals[groupcol].data();
+  const unsigned char *valid = batch.valid[groupcol].data();
+  int type = batch.isint[groupcol] ? SQLITE_INTEGER : SQLITE_FLOAT;
+  size_t stride = (size_t)ncols * bins;
+  int group = -1, lastgroup = -1;
+  double lastnum = 0.0;
+  for (unsigned j = 0; j < batch.nrows; j++)
+  {
+    int id = batch.TextId(groupcol, j);
+    if (id >= 0)
+    {
+      if (textgroups[id] < 0)
+        textgroups[id] = Group(groupkey(SQLITE_TEXT, 0.0, batch.texts[groupcol][id]));
+      group = textgroups[id];
+    }
+    else if (!valid[j])
+    {
+      group = Group(groupkey());
+    }
+    else
+    {
+      if (lastgroup < 0 || vals[j] != lastnum)
+      {
+        lastnum = vals[j];
+        lastgroup = Group(groupkey(type, lastnum));
+      }
+      group = lastgroup;
+    }
+    offsets[j] = group * stride;
+  }
+  for (int k = 0; k < ncols; k++)
+    AccumGroupedCounts(counts.data() + k * bins, bins, offsets.data(), columnview(batch, k),
+      minbin, maxbin, edges);
+}
+
+
+void grouphistograms::Merge(const grouphistograms &other)
+{
+  size_t stride = (size_t)ncols * bins;
+  for (unsigned g = 0; g < other.keys.size(); g++)
+  {
+    size_t offset = Group(other.keys[g]) * stride;
+    for (size_t i = 0; i < stride; i++)
+      counts[offset + i] += other.counts[g * stride + i];
+  }
+}
+
+
+void grouphistograms::Finalize(std::vector<groupkey> &sortedkeys, std::vector<histobin> &histo) const
+{
+  std::vector<int> order(keys.size());
+  for (unsigned g = 0; g < order.size(); g++)
+    order[g] = g;
+  std::sort(order.begin(), order.end(), [this](int a, int b) { return keys[a] < keys[b]; });
+
+  size_t stride = (size_t)ncols * bins;
+  sortedkeys.resize(keys.size());
+  histo.resize(keys.size() * stride);
+  for (unsigned g = 0; g < order.size(); g++)
+  {
+    sortedkeys[g] = keys[order[g]];
+    histobin *h = histo.data() + g * stride;
+    const int *c = counts.data() + order[g] * stride;
+    for (int k = 0; k < ncols; k++)
+    {
+      InitHistogram(h + k * bins, bins, minbin, maxbin, edges);
+      for (int i = 0; i < bins; i++)
+        h[k * bins + i].count = c[k * bins + i];
+      FinalizeHistogram(h + k * bins, bins);
+    }
+  }
+}
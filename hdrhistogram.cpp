@@ -0,0 +1,684 @@
+/*
+hdrhistogram.cpp
+
+SQLite extension for HDR histograms of values such as request latencies spanning many orders 
+of magnitude with log-linear buckets of a fixed relative width, and the HDRPERCENTILE 
+aggregate for estimating percentiles of such values from the same buckets.
+
+The MIT License (MIT)
+
+Copyright (c) 2017 Robert Oeffner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+#include "RegistExt.h"
+#include "helpers.h"
+#include <assert.h>
+#include <memory.h>
+
+
+
+static sqlite3_uint64 DoubleBits(double x)
+{
+  sqlite3_uint64 bits;
+  memcpy(&bits, &x, sizeof(bits));
+  return bits;
+}
+
+
+static double BitsDouble(sqlite3_uint64 bits)
+{
+  double x;
+  memcpy(&x, &bits, sizeof(x));
+  return x;
+}
+
+
+// Bucket of the largest finite double
+static sqlite3_int64 MaxKey(int shift)
+{
+  return (sqlite3_int64)(DoubleBits(DBL_MAX) >> shift);
+}
+
+
+void hdrbuckets::Reset(int digits)
+{
+  // the fewest bits splitting a power of two into buckets narrower than 10^-digits of it
+  subbits = 0;
+  while (ldexp(1.0, -subbits) >= pow(10.0, -digits))
+    subbits++;
+  shift = 52 - subbits;
+  zeros = 0;
+  ntotal = 0;
+  firstkey = 0;
+  counts.clear();
+}
+
+
+/* Make the array of counts span the buckets from minkey to maxkey. It grows by at least its
+size so a range of values that widens slowly is only copied a few times.
+*/
+void hdrbuckets::Span(sqlite3_int64 minkey, sqlite3_int64 maxkey)
+{
+  if (counts.empty())
+  {
+    firstkey = minkey;
+    counts.assign(maxkey - minkey + 1, 0);
+    return;
+  }
+  sqlite3_int64 size = counts.size();
+  sqlite3_int64 lastkey = firstkey + size - 1;
+  if (minkey >= firstkey && maxkey <= lastkey)
+    return;
+  sqlite3_int64 lo = firstkey, hi = lastkey;
+  if (minkey < firstkey)
+    lo = std::max((sqlite3_int64)0, std::min(minkey, firstkey - size));
+  if (maxkey > lastkey)
+    hi = std::min(MaxKey(shift), std::max(maxkey, lastkey + size));
+  std::vector<sqlite3_int64> grown(hi - lo + 1, 0);
+  std::copy(counts.begin(), counts.end(), grown.begin() + (firstkey - lo));
+  counts.swap(grown);
+  firstkey = lo;
+}
+
+
+void hdrbuckets::Add(double val)
+{
+  if (val == 0.0)
+  {
+    zeros++;
+    ntotal++;
+    return;
+  }
+  if (!(val > 0.0 && val <= DBL_MAX))
+    return;
+  sqlite3_int64 key = DoubleBits(val) >> shift;
+  Span(key, key);
+  counts[key - firstkey]++;
+  ntotal++;
+}
+
+
+/* The buckets of the values of a batch are found first so the array of counts is resized
+at most once per batch
+*/
+void hdrbuckets::Accum(columnview y)
+{
+  static thread_local std::vector<sqlite3_int64> keys;
+  if (keys.size() < y.n)
+    keys.resize(y.n);
+  sqlite3_int64 minkey = MaxKey(shift), maxkey = -1;
+  for (unsigned j = 0; j < y.n; j++)
+  {
+    double val = y.vals[j];
+    keys[j] = -1;
+    if (!y.valid[j])
+      continue;
+    if (val == 0.0)
+    {
+      zeros++;
+      ntotal++;
+    }
+    else if (val > 0.0 && val <= DBL_MAX)
+    {
+      keys[j] = DoubleBits(val) >> shift;
+      minkey = std::min(minkey, keys[j]);
+      maxkey = std::max(maxkey, keys[j]);
+    }
+  }
+  if (maxkey < 0)
+    return;
+  Span(minkey, maxkey);
+  sqlite3_int64 *c = counts.data() - firstkey;
+  for (unsigned j = 0; j < y.n; j++)
+  {
+    if (keys[j] >= 0)
+    {
+      c[keys[j]]++;
+      ntotal++;
+    }
+  }
+}
+
+
+void hdrbuckets::Merge(const hdrbuckets &other)
+{
+  assert(other.subbits == subbits);
+  zeros += other.zeros;
+  ntotal += other.ntotal;
+  if (other.counts.empty())
+    return;
+  Span(other.firstkey, other.firstkey + other.counts.size() - 1);
+  for (size_t i = 0; i < other.counts.size(); i++)
+    counts[other.firstkey - firstkey + i] += other.counts[i];
+}
+
+
+void hdrbuckets::Finalize(std::vector<hdrbucket> &buckets) const
+{
+  buckets.clear();
+  sqlite3_int64 accumcount = 0;
+  if (zeros > 0)
+  {
+    accumcount = zeros;
+    hdrbucket b = { 0.0, 0.0, zeros, accumcount, 100.0 * accumcount / ntotal };
+    buckets.push_back(b);
+  }
+  for (size_t i = 0; i < counts.size(); i++)
+  {
+    if (counts[i] == 0)
+      continue;
+    sqlite3_uint64 key = firstkey + i;
+    accumcount += counts[i];
+    hdrbucket b = { BitsDouble(key << shift), BitsDouble((key + 1) << shift), counts[i],
+      accumcount, 100.0 * accumcount / ntotal };
+    buckets.push_back(b);
+  }
+}
+
+
+double hdrbuckets::Percentile(double p) const
+{
+  if (ntotal == 0)
+    return NAN;
+  sqlite3_int64 rank = (sqlite3_int64)ceil(p / 100.0 * ntotal);
+  rank = std::max((sqlite3_int64)1, std::min(rank, ntotal));
+  if (rank <= zeros)
+    return 0.0;
+  sqlite3_int64 accumcount = zeros;
+  size_t i = 0;
+  for (; i + 1 < counts.size(); i++)
+  {
+    accumcount += counts[i];
+    if (accumcount >= rank)
+      break;
+  }
+  sqlite3_uint64 key = firstkey + i;
+  return 0.5 * (BitsDouble(key << shift) + BitsDouble((key + 1) << shift));
+}
+
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+
+/* State of the HDRPERCENTILE aggregate which is allocated on the first row of a group and
+freed by HdrPercentileFinal
+*/
+struct hdrpercentilectx
+{
+  hdrbuckets buckets;
+  double percentile;
+};
+
+
+/* HDRPERCENTILE(value, percentile [, digits]) estimates the value at percentile between 
+0 and 100 of the non-NULL values of a group from their HDR buckets of digits significant
+digits, 3 by default
+*/
+void HdrPercentileStep(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+  hdrpercentilectx **pp = (hdrpercentilectx **)sqlite3_aggregate_context(context, sizeof(*pp));
+  if (pp == NULL)
+  {
+    sqlite3_result_error_nomem(context);
+    return;
+  }
+  if (*pp == NULL)
+  {
+    double percentile = sqlite3_value_double(argv[1]);
+    int digits = argc > 2 ? sqlite3_value_int(argv[2]) : 3;
+    if (!(percentile >= 0.0 && percentile <= 100.0))
+    {
+      sqlite3_result_error(context, "HDRPERCENTILE percentile must be between 0 and 100", -1);
+      return;
+    }
+    if (digits < MINHDRDIGITS || digits > MAXHDRDIGITS)
+    {
+      sqlite3_result_error(context, "HDRPERCENTILE digits must be between 1 and 5", -1);
+      return;
+    }
+    *pp = new hdrpercentilectx;
+    (*pp)->buckets.Reset(digits);
+    (*pp)->percentile = percentile;
+  }
+  if (SQLITE_NULL != sqlite3_value_numeric_type(argv[0]))
+    (*pp)->buckets.Add(sqlite3_value_double(argv[0]));
+}
+
+
+void HdrPercentileFinal(sqlite3_context *context)
+{
+  hdrpercentilectx **pp = (hdrpercentilectx **)sqlite3_aggregate_context(context, 0);
+  if (pp == NULL || *pp == NULL)
+  {
+    sqlite3_result_null(context);
+    return;
+  }
+  double val = (*pp)->buckets.Percentile((*pp)->percentile);
+  if (std::isnan(val))
+    sqlite3_result_null(context);
+  else
+    sqlite3_result_double(context, val);
+  delete *pp;
+  *pp = NULL;
+}
+
+
+
+#ifndef SQLITE_OMIT_VIRTUALTABLE
+
+
+
+/* hdrhisto_cursor is a subclass of sqlite3_vtab_cursor which will
+** serve as the underlying representation of a cursor that scans
+** over rows of the result
+*/
+typedef struct hdrhisto_cursor hdrhisto_cursor;
+struct hdrhisto_cursor {
+  sqlite3_vtab_cursor base;  /* Base class - must be first */
+  sqlite3_int64 iRowid;      /* The rowid */
+  std::string    tblname;
+  std::string    colid;
+  int            digits;
+  std::string    whereclause;
+  double         sample;
+  samplestats    stats;
+  std::string    scansql;
+  std::string    scanplan;
+  int            scanthreads;
+  hdrbuckets     buckets;
+  std::vector<hdrbuckets> partial; // private buckets of the scan threads
+  std::vector<hdrbucket> rows; // the occupied buckets in ascending order
+};
+
+
+
+enum ColNum
+{ /* Column numbers. The order determines the order of columns in the table output
+  and must match the order of columns in the CREATE TABLE statement below
+  */
+  HDRHISTO_LOWER = 0,
+  HDRHISTO_UPPER,
+  HDRHISTO_COUNT,
+  HDRHISTO_ACCUMCOUNT,
+  HDRHISTO_PERCENTILE,
+  HDRHISTO_TBLNAME,
+  HDRHISTO_COLID,
+  HDRHISTO_DIGITS,
+  HDRHISTO_WHERE,
+  HDRHISTO_SAMPLE,
+  HDRHISTO_SCANPLAN,    /* output only hidden columns follow the argument columns */
+  HDRHISTO_ESTCOUNT,
+  HDRHISTO_CILOWER,
+  HDRHISTO_CIUPPER
+};
+
+
+int hdrhistoConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+)
+{
+  histo_vtab *pNew;
+  int rc;
+/* The hidden columns serves as arguments to the HDRHISTO function as in:
+SELECT * FROM HDRHISTO('tblname', 'colid', digits);
+They won't show up in the SQL tables.
+*/
+  rc = sqlite3_declare_vtab(db,
+// Order of columns MUST match the order of the above enum ColNum
+  "CREATE TABLE x(lowerbound REAL, upperbound REAL, bincount INTEGER, accumcount INTEGER, " \
+  "percentile REAL, tblname hidden, colid hidden, digits hidden, " \
+  "whereclause hidden, sample hidden, scanplan hidden, estcount hidden, cilower hidden, ciupper hidden)");
+  if( rc==SQLITE_OK )
+  {
+    pNew = (histo_vtab *)sqlite3_malloc( sizeof(*pNew) );
+    if( pNew==0 ) return SQLITE_NOMEM;
+    memset(pNew, 0, sizeof(*pNew));
+    pNew->db = db;
+    *ppVtab = &pNew->base;
+    AcquireStmtCache(db);
+  }
+  thisdb = db;
+  return rc;
+}
+
+/*
+** This method is the destructor for hdrhisto_cursor objects.
+*/
+int hdrhistoDisconnect(sqlite3_vtab *pVtab){
+  ReleaseStmtCache(((histo_vtab *)pVtab)->db);
+  sqlite3_free(pVtab);
+  return SQLITE_OK;
+}
+
+/*
+** Constructor for a new hdrhisto_cursor object.
+*/
+int hdrhistoOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **ppCursor){
+  hdrhisto_cursor *pCur;
+  // allocate c++ object with new rather than sqlite3_malloc which doesn't call constructors
+  pCur = new hdrhisto_cursor;
+  if (pCur == NULL) return SQLITE_NOMEM;
+  *ppCursor = &pCur->base;
+  return SQLITE_OK;
+}
+
+/*
+** Destructor for a hdrhisto_cursor.
+*/
+int hdrhistoClose(sqlite3_vtab_cursor *cur){
+  delete cur;
+  return SQLITE_OK;
+}
+
+
+/*
+** Advance a hdrhisto_cursor to its next row of output.
+*/
+int hdrhistoNext(sqlite3_vtab_cursor *cur){
+  hdrhisto_cursor *pCur = (hdrhisto_cursor*)cur;
+  pCur->iRowid++;
+  return SQLITE_OK;
+}
+
+/*
+** Return values of columns for the row at which the hdrhisto_cursor
+** is currently pointing.
+*/
+int hdrhistoColumn(
+  sqlite3_vtab_cursor *cur,   /* The cursor */
+  sqlite3_context *ctx,       /* First argument to sqlite3_result_...() */
+  int i                       /* Which column to return */
+){
+  hdrhisto_cursor *pCur = (hdrhisto_cursor*)cur;
+  const hdrbucket &b = pCur->rows[pCur->iRowid - 1];
+  sqlite3_int64 x = 123456;
+  std::string c = "waffle";
+  double d = -42.24;
+  switch( i ){
+    case HDRHISTO_LOWER:      d = b.lower; sqlite3_result_double(ctx, d); break;
+    case HDRHISTO_UPPER:      d = b.upper; sqlite3_result_double(ctx, d); break;
+    case HDRHISTO_COUNT:      x = b.count; sqlite3_result_int64(ctx, x); break;
+    case HDRHISTO_ACCUMCOUNT: x = b.accumcount; sqlite3_result_int64(ctx, x); break;
+    case HDRHISTO_PERCENTILE: d = b.percentile; sqlite3_result_double(ctx, d); break;
+    case HDRHISTO_TBLNAME:    c = pCur->tblname; sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT);  break;
+    case HDRHISTO_COLID:      c = pCur->colid; sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT); break;
+    case HDRHISTO_DIGITS:     x = pCur->digits; sqlite3_result_int64(ctx, x); break;
+    case HDRHISTO_WHERE:      c = pCur->whereclause; sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT); break;
+    case HDRHISTO_SAMPLE:     d = pCur->sample; sqlite3_result_double(ctx, d); break;
+    case HDRHISTO_SCANPLAN: {
+      if (pCur->scanplan == "") // only look up the query plan if it is asked for
+        pCur->scanplan = QueryPlan(thisdb, pCur->scansql);
+      if (pCur->scanthreads > 1)
+        c = std::to_string(pCur->scanthreads) + " THREADS: " + pCur->scanplan;
+      else
+        c = pCur->scanplan;
+      sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT);
+    } break;
+    case HDRHISTO_ESTCOUNT:
+    case HDRHISTO_CILOWER:
+    case HDRHISTO_CIUPPER: {
+      if (pCur->sample <= 0.0)
+      { // counts are exact if not sampling rows
+        sqlite3_result_null(ctx);
+        break;
+      }
+      double estcount, cilower, ciupper;
+      EstimateCount(pCur->stats, b.count, &estcount, &cilower, &ciupper);
+      d = i == HDRHISTO_ESTCOUNT ? estcount : (i == HDRHISTO_CILOWER ? cilower : ciupper);
+      sqlite3_result_double(ctx, d);
+    } break;
+    default:           sqlite3_result_double(ctx, 0); break;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Return the rowid for the current row.  In this implementation, the
+** rowid is the same as the output value.
+*/
+int hdrhistoRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid){
+  hdrhisto_cursor *pCur = (hdrhisto_cursor*)cur;
+  *pRowid = pCur->iRowid;
+  return SQLITE_OK;
+}
+
+/*
+** Return TRUE if the cursor has been moved off of the last
+** row of output.
+*/
+int hdrhistoEof(sqlite3_vtab_cursor *cur) {
+  hdrhisto_cursor *pCur = (hdrhisto_cursor*)cur;
+  return pCur->iRowid > (sqlite3_int64)pCur->rows.size();
+}
+
+
+
+int hdrhistoFilter(
+  sqlite3_vtab_cursor *pVtabCursor, 
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+){
+  hdrhisto_cursor *pCur = (hdrhisto_cursor *)pVtabCursor;
+  int i = 0, rc = SQLITE_OK;
+  pCur->tblname = "";
+  pCur->colid = "";
+  pCur->digits = 3;
+  pCur->whereclause = "";
+  pCur->sample = 0.0;
+  pCur->rows.clear();
+
+  if( RequiredArgs(idxNum) >= HDRHISTO_DIGITS)
+  {
+    pCur->tblname = (const char*)sqlite3_value_text(argv[i++]);
+    pCur->colid = (const char*)sqlite3_value_text(argv[i++]);
+    pCur->digits = sqlite3_value_int(argv[i++]);
+    if (idxNum & ARG_WHERE && sqlite3_value_type(argv[i]) != SQLITE_NULL)
+      pCur->whereclause = (const char*)sqlite3_value_text(argv[i]);
+    if (idxNum & ARG_WHERE)
+      i++;
+    if (idxNum & ARG_SAMPLE)
+      pCur->sample = sqlite3_value_double(argv[i++]);
+  }
+  else 
+  {
+    const char *zText = "Incorrect arguments for function HDRHISTO which must be called as:\n" \
+     " HDRHISTO('tablename', 'columnname', digits [, 'whereclause', sample])\n";
+    pCur->base.pVtab->zErrMsg = sqlite3_mprintf(zText);
+    return SQLITE_ERROR;
+  }
+  if (pCur->digits < MINHDRDIGITS || pCur->digits > MAXHDRDIGITS)
+  {
+    pCur->base.pVtab->zErrMsg = sqlite3_mprintf("HDRHISTO digits must be between %d and %d",
+      MINHDRDIGITS, MAXHDRDIGITS);
+    return SQLITE_ERROR;
+  }
+  pCur->buckets.Reset(pCur->digits);
+
+  std::string errmsg;
+  rc = CheckColumns(thisdb, pCur->tblname, { pCur->colid }, &errmsg);
+  if (rc != SQLITE_OK)
+  {
+    pCur->base.pVtab->zErrMsg = sqlite3_mprintf("%s", errmsg.c_str());
+    return rc;
+  }
+  std::string s_tbl = QuoteTableName(pCur->tblname);
+  std::string s_col = QuoteId(pCur->colid);
+
+  // negative values have no buckets
+  std::string s_where = s_col + " >= 0";
+  if (pCur->whereclause != "")
+    s_where += " AND (" + pCur->whereclause + ")";
+  std::vector<double> params;
+  pCur->scansql = SelectSql(s_col, s_tbl, s_where);
+  pCur->scanplan = "";
+  pCur->scanthreads = 1;
+  auto accumulate = [pCur](const columnset &batch)
+  {
+    pCur->buckets.Accum(columnview(batch, 0));
+  };
+  std::vector<std::string> colids = { pCur->colid };
+  rc = SQLITE_MISUSE;
+  bool cached = false;
+  sqlite3_int64 ncached = 0;
+  if (pCur->sample > 0.0)
+  { // bucket a random sample of the rows
+    rc = SampleReadBatches(thisdb, s_tbl, SelectSql(s_col, s_tbl, ""),
+      s_where, params, pCur->sample, &pCur->stats, accumulate);
+    pCur->scansql = pCur->stats.sqlxprs;
+  }
+  else if (pCur->whereclause == "" && ColumnCacheReady(thisdb, pCur->tblname, colids, &ncached))
+  { // read the values from the blocks of the columnar cache
+    cached = true;
+    rc = CachedReadBatches(thisdb, pCur->tblname, colids, ncached, accumulate);
+    pCur->scanplan = ColumnCachePlan(pCur->tblname, colids);
+  }
+  else if (histoconfig.scanthreads > 1)
+  { // each worker thread counts its rowid range into private buckets
+    pCur->partial.assign(histoconfig.scanthreads, pCur->buckets);
+    std::string s_select = SelectSql(s_col, s_tbl, "");
+    rc = ParallelReadBatches(thisdb, s_tbl, s_select, s_where, params,
+      histoconfig.scanthreads, [pCur](int ithread, const columnset &batch)
+    {
+      pCur->partial[ithread].Accum(columnview(batch, 0));
+    });
+    if (rc == SQLITE_OK)
+    {
+      for (unsigned t = 0; t < pCur->partial.size(); t++)
+        pCur->buckets.Merge(pCur->partial[t]);
+      pCur->scansql = RowidRangeSql(s_select, s_where, 0, 0);
+      pCur->scanthreads = histoconfig.scanthreads;
+    }
+    pCur->partial.clear();
+  }
+  if (rc != SQLITE_OK && pCur->sample <= 0.0 && !cached)
+  { // stream the values into the buckets batch by batch
+    rc = ReadBatches(thisdb, pCur->scansql, params, accumulate);
+  }
+  if (rc != SQLITE_OK)
+  {
+    pCur->base.pVtab->zErrMsg = sqlite3_mprintf(sqlite3_errmsg(thisdb));
+    return rc;
+  }
+  pCur->buckets.Finalize(pCur->rows);
+  pCur->buckets.Reset(pCur->digits);
+
+  pCur->iRowid = 1;
+  return SQLITE_OK;
+}
+
+
+int hdrhistoBestIndex(
+  sqlite3_vtab *tab,
+  sqlite3_index_info *pIdxInfo
+){
+  int idxNum = 0;        /* The query plan bitmask */
+  int nArg = 0;          /* Number of arguments that hdrhistoFilter() expects */
+  int argidx[HDRHISTO_SAMPLE + 1]; /* Index of the constraint of each argument column or -1 */
+  for (int c = 0; c <= HDRHISTO_SAMPLE; c++)
+    argidx[c] = -1;
+
+  sqlite3_index_info::sqlite3_index_constraint *pConstraint;
+  pConstraint = pIdxInfo->aConstraint;
+  for(int i=0; i<pIdxInfo->nConstraint; i++, pConstraint++){
+    if( pConstraint->usable==0 ) continue;
+    if( pConstraint->op!=SQLITE_INDEX_CONSTRAINT_EQ ) continue;
+    if (pConstraint->iColumn >= HDRHISTO_TBLNAME && pConstraint->iColumn <= HDRHISTO_SAMPLE)
+      argidx[pConstraint->iColumn] = i;
+  }
+  // the required arguments must all be present and come first in the order of the columns
+  for (int c = HDRHISTO_TBLNAME; c <= HDRHISTO_DIGITS && argidx[c] >= 0; c++)
+  {
+    pIdxInfo->aConstraintUsage[argidx[c]].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[argidx[c]].omit = 1;
+    idxNum = c;
+  }
+  if (idxNum == HDRHISTO_DIGITS && argidx[HDRHISTO_WHERE] >= 0) { // optional arguments follow
+    pIdxInfo->aConstraintUsage[argidx[HDRHISTO_WHERE]].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[argidx[HDRHISTO_WHERE]].omit = 1;
+    idxNum |= ARG_WHERE;
+  }
+  if (RequiredArgs(idxNum) == HDRHISTO_DIGITS && argidx[HDRHISTO_SAMPLE] >= 0) {
+    pIdxInfo->aConstraintUsage[argidx[HDRHISTO_SAMPLE]].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[argidx[HDRHISTO_SAMPLE]].omit = 1;
+    idxNum |= ARG_SAMPLE;
+  }
+  pIdxInfo->estimatedCost = 2.0;
+  pIdxInfo->estimatedRows = 500;
+  pIdxInfo->idxNum = idxNum;
+  return SQLITE_OK;
+}
+
+
+
+
+/*
+** This following structure defines all the methods for the
+** generate_hdrhisto virtual table.
+*/
+sqlite3_module hdrhistoModule = {
+  0,                         /* iVersion */
+  0,                         /* xCreate */
+  hdrhistoConnect,             /* xConnect */
+  hdrhistoBestIndex,           /* xBestIndex */
+  hdrhistoDisconnect,          /* xDisconnect */
+  0,                         /* xDestroy */
+  hdrhistoOpen,                /* xOpen - open a cursor */
+  hdrhistoClose,               /* xClose - close a cursor */
+  hdrhistoFilter,              /* xFilter - configure scan constraints */
+  hdrhistoNext,                /* xNext - advance a cursor */
+  hdrhistoEof,                 /* xEof - check for end of scan */
+  hdrhistoColumn,              /* xColumn - read data */
+  hdrhistoRowid,               /* xRowid - read data */
+  0,                         /* xUpdate */
+  0,                         /* xBegin */
+  0,                         /* xSync */
+  0,                         /* xCommit */
+  0,                         /* xRollback */
+  0,                         /* xFindMethod */
+  0,                         /* xRename */
+};
+
+
+
+#endif /* SQLITE_OMIT_VIRTUALTABLE */
+
+
+
+
+#ifdef __cplusplus
+}
+#endif
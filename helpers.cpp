@@ -27,183 +27,1378 @@ SOFTWARE.
 
 
 #include "helpers.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
 
 
+histosettings histoconfig;
 
-std::vector< std::vector<double> > GetColumns(sqlite3* db, std::string sqlxprs, int *rc)
-{
-  // get column from sql expression and return it 
-  char *zErrMsg;
-  char **result;
-  int nrow, ncol;
-  int db_open;
-  *rc = sqlite3_get_table(
-    db,              /* An open database */
-    sqlxprs.c_str(),       /* SQL to be executed */
-    &result,       /* Result written to a char *[]  that this points to */
-    &nrow,             /* Number of result rows written here */
-    &ncol,          /* Number of result columns written here */
-    &zErrMsg          /* Error msg written here */
-    );
-/* If SQL table is structured as:
-  Name        | Age
-  -----------------------
-  Alice       | 43
-  Bob         | 28
-  Cindy       | 21
-
-  then &result will look like:
-
-  result[0] = "Name";
-  result[1] = "Age";
-  result[2] = "Alice";
-  result[3] = "43";
-  result[4] = "Bob";
-  result[5] = "28";
-  result[6] = "Cindy";
-  result[7] = "21";
-*/
-  std::vector< std::vector<double> > columns;
-  columns.clear();
-  columns.resize(ncol);
-
-  for (int n = 0; n < ncol; n++)
-  {
-    columns[n].resize(nrow);
-  }
-  if (*rc == SQLITE_OK) {
-    for (int i = 0; i < nrow*ncol; i++)
+
+int *HistoSetting(std::string name, int *minval)
+{
+  *minval = 1;
+  if (name == "scanthreads")
+    return &histoconfig.scanthreads;
+  *minval = 0;
+  if (name == "sampleseed")
+    return &histoconfig.sampleseed;
+  if (name == "binkernel")
+    return &histoconfig.binkernel;
+  *minval = 1;
+  if (name == "poolthreads")
+    return &histoconfig.poolthreads;
+  return NULL;
+}
+
+
+
+std::string QuoteId(std::string name)
+{
+  std::string quoted = "\"";
+  for (unsigned i = 0; i < name.size(); i++)
+  {
+    if (name[i] == '"')
+      quoted += '"';
+    quoted += name[i];
+  }
+  return quoted + "\"";
+}
+
+
+void SplitTableName(std::string tblname, std::string *schema, std::string *table)
+{
+  size_t dot = tblname.find('.');
+  *schema = dot == std::string::npos ? "" : tblname.substr(0, dot);
+  *table = dot == std::string::npos ? tblname : tblname.substr(dot + 1);
+}
+
+
+std::string QuoteTableName(std::string tblname)
+{
+  std::string schema, table;
+  SplitTableName(tblname, &schema, &table);
+  return schema == "" ? QuoteId(table) : QuoteId(schema) + "." + QuoteId(table);
+}
+
+
+std::vector<std::string> SplitColumnList(std::string colids)
+{
+  std::vector<std::string> names;
+  size_t start = 0;
+  while (true)
+  {
+    size_t end = colids.find(',', start);
+    std::string name = colids.substr(start, end == std::string::npos ? end : end - start);
+    size_t first = name.find_first_not_of(" \t\n");
+    size_t last = name.find_last_not_of(" \t\n");
+    names.push_back(first == std::string::npos ? "" : name.substr(first, last - first + 1));
+    if (end == std::string::npos)
+      break;
+    start = end + 1;
+  }
+  return names;
+}
+
+
+int JoinInList(sqlite3_value *inlist, std::string *colids, std::string *errmsg)
+{
+  *colids = "";
+  sqlite3_value *val = NULL;
+  int rc = sqlite3_vtab_in_first(inlist, &val);
+  while (rc == SQLITE_OK && val != NULL)
+  {
+    const char *name = (const char*)sqlite3_value_text(val);
+    if (*colids != "")
+      *colids += ", ";
+    *colids += name == NULL ? "" : name;
+    rc = sqlite3_vtab_in_next(inlist, &val);
+  }
+  if (rc == SQLITE_DONE)
+    rc = SQLITE_OK;
+  if (rc != SQLITE_OK)
+    *errmsg = "could not read the list of column names";
+  return rc;
+}
+
+
+int CheckColumns(sqlite3 *db, std::string tblname, const std::vector<std::string> &colids,
+                 std::string *errmsg)
+{
+  int rc = SQLITE_OK;
+  std::string schema, table;
+  SplitTableName(tblname, &schema, &table);
+  sqlite3_stmt *stmt = GetCachedStmt(db, "SELECT name FROM pragma_table_info(?1, ?2)", &rc);
+  if (rc == SQLITE_OK)
+    rc = sqlite3_bind_text(stmt, 1, table.c_str(), -1, SQLITE_TRANSIENT);
+  if (rc == SQLITE_OK) // NULL searches all schemas
+    rc = schema == "" ? sqlite3_bind_null(stmt, 2)
+      : sqlite3_bind_text(stmt, 2, schema.c_str(), -1, SQLITE_TRANSIENT);
+  if (rc != SQLITE_OK)
+  {
+    *errmsg = sqlite3_errmsg(db);
+    return rc;
+  }
+  std::vector<std::string> names;
+  while (sqlite3_step(stmt) == SQLITE_ROW)
+    names.push_back((const char*)sqlite3_column_text(stmt, 0));
+  sqlite3_reset(stmt);
+  if (names.empty())
+  {
+    *errmsg = "no such table: " + tblname;
+    return SQLITE_ERROR;
+  }
+
+  for (unsigned c = 0; c < colids.size(); c++)
+  {
+    bool found = colids[c] == "";
+    for (unsigned k = 0; k < names.size() && !found; k++)
+      found = sqlite3_stricmp(names[k].c_str(), colids[c].c_str()) == 0;
+    if (!found)
+    {
+      *errmsg = "no such column: " + colids[c] + " in table " + tblname;
+      return SQLITE_ERROR;
+    }
+  }
+  return SQLITE_OK;
+}
+
+
+
+std::string SelectSql(std::string columns, std::string tblname, std::string whereclause)
+{
+  std::string s_exe = "SELECT " + columns + " FROM " + tblname;
+  if (whereclause != "")
+    s_exe += " WHERE (" + whereclause + ")";
+  return s_exe;
+}
+
+
+
+std::string BinRangeClause(std::string colid, std::string whereclause)
+{
+  std::string s_where = colid + " >= ?1 AND " + colid + " < ?2";
+  if (whereclause != "")
+    s_where += " AND (" + whereclause + ")";
+  return s_where;
+}
+
+
+std::string BinRangeClause(const std::vector<std::string> &colids, std::string whereclause)
+{
+  if (colids.size() == 1)
+    return BinRangeClause(colids[0], whereclause);
+  std::string s_where = "(";
+  for (unsigned c = 0; c < colids.size(); c++)
+  {
+    if (c > 0)
+      s_where += " OR ";
+    s_where += colids[c] + " >= ?1 AND " + colids[c] + " < ?2";
+  }
+  s_where += ")";
+  if (whereclause != "")
+    s_where += " AND (" + whereclause + ")";
+  return s_where;
+}
+
+
+std::string QueryPlan(sqlite3* db, std::string sqlxprs)
+{
+  sqlite3_stmt *stmt;
+  std::string s_exe = "EXPLAIN QUERY PLAN " + sqlxprs;
+  std::string plan;
+  if (sqlite3_prepare_v2(db, s_exe.c_str(), -1, &stmt, NULL) != SQLITE_OK)
+    return plan;
+  while (sqlite3_step(stmt) == SQLITE_ROW)
+  { // the last column of each row holds the detail text of a step in the plan 
+    const char *detail = (const char*)sqlite3_column_text(stmt, sqlite3_column_count(stmt) - 1);
+    if (detail == NULL)
+      continue;
+    if (plan != "")
+      plan += "; ";
+    plan += detail;
+  }
+  sqlite3_finalize(stmt);
+  return plan;
+}
+
+
+
+/* Maximum number of statements cached per connection before the idle ones are finalized.
+Statements that are being stepped are never finalized or reset by the cache. A statement that
+is looked up while its cached copy is busy, as in a nested histogram query, gets a copy of its
+own. Statements prepared with sqlite3_prepare_v2() are prepared again by SQLite when the schema
+changes so the cache need not watch the schema.
+*/
+const unsigned MAXCACHEDSTMTS = 64;
+
+struct stmtcache
+{
+  int refcount;
+  std::multimap<std::string, sqlite3_stmt*> stmts;
+  stmtcache()
+  {
+    refcount = 0;
+  }
+  void Clear()
+  {
+    std::multimap<std::string, sqlite3_stmt*>::iterator it;
+    for (it = stmts.begin(); it != stmts.end(); ++it)
+      sqlite3_finalize(it->second);
+    stmts.clear();
+  }
+  void ClearIdle()
+  {
+    std::multimap<std::string, sqlite3_stmt*>::iterator it = stmts.begin();
+    while (it != stmts.end())
+    {
+      if (sqlite3_stmt_busy(it->second))
+      {
+        ++it;
+        continue;
+      }
+      sqlite3_finalize(it->second);
+      it = stmts.erase(it);
+    }
+  }
+};
+
+static std::map<sqlite3*, stmtcache> stmtcaches;
+static std::mutex stmtcachemutex;
+
+
+void AcquireStmtCache(sqlite3 *db)
+{
+  std::lock_guard<std::mutex> lock(stmtcachemutex);
+  stmtcaches[db].refcount++;
+}
+
+
+void ReleaseStmtCache(sqlite3 *db)
+{
+  std::lock_guard<std::mutex> lock(stmtcachemutex);
+  std::map<sqlite3*, stmtcache>::iterator it = stmtcaches.find(db);
+  if (it == stmtcaches.end() || --it->second.refcount > 0)
+    return;
+  // the last virtual table on this connection is going away so finalize the statements
+  it->second.Clear();
+  stmtcaches.erase(it);
+}
+
+
+sqlite3_stmt *GetCachedStmt(sqlite3 *db, std::string sqlxprs, int *rc)
+{
+  std::lock_guard<std::mutex> lock(stmtcachemutex);
+  stmtcache &cache = stmtcaches[db];
+  *rc = SQLITE_OK;
+  typedef std::multimap<std::string, sqlite3_stmt*>::iterator stmtiter;
+  std::pair<stmtiter, stmtiter> range = cache.stmts.equal_range(sqlxprs);
+  for (stmtiter it = range.first; it != range.second; ++it)
+  {
+    if (sqlite3_stmt_busy(it->second)) // still being stepped by a caller
+      continue;
+    sqlite3_reset(it->second);
+    sqlite3_clear_bindings(it->second);
+    return it->second;
+  }
+
+  if (cache.stmts.size() >= MAXCACHEDSTMTS)
+    cache.ClearIdle();
+  sqlite3_stmt *stmt = NULL;
+  *rc = sqlite3_prepare_v2(db, sqlxprs.c_str(), -1, &stmt, NULL);
+  if (*rc != SQLITE_OK)
+    return NULL;
+  cache.stmts.insert(std::make_pair(sqlxprs, stmt));
+  return stmt;
+}
+
+
+
+ColumnReader::ColumnReader(sqlite3* db, std::string sqlxprs, int *rc, int textcol)
+{
+  stmt = NULL;
+  owned = true;
+  this->textcol = textcol;
+  *rc = sqlite3_prepare_v2(db, sqlxprs.c_str(), -1, &stmt, NULL);
+  steprc = *rc == SQLITE_OK ? SQLITE_ROW : *rc;
+  FindIntegerColumns();
+}
+
+
+ColumnReader::ColumnReader(sqlite3_stmt *cachedstmt, int textcol)
+{
+  stmt = cachedstmt;
+  owned = false;
+  this->textcol = textcol;
+  steprc = SQLITE_ROW;
+  FindIntegerColumns();
+}
+
+
+/* A declared type containing "INT" gives a column INTEGER affinity, see
+https://www.sqlite.org/datatype3.html#determination_of_column_affinity
+Expressions and columns of views on expressions have no declared type.
+*/
+void ColumnReader::FindIntegerColumns()
+{
+  intcol.assign(ncols(), 0);
+  for (unsigned c = 0; c < intcol.size(); c++)
+  {
+    const char *decl = sqlite3_column_decltype(stmt, c);
+    intcol[c] = decl != NULL && sqlite3_strlike("%INT%", decl, 0) == 0;
+  }
+}
+
+
+ColumnReader::~ColumnReader()
+{
+  if (owned)
+    sqlite3_finalize(stmt);
+  else
+    sqlite3_reset(stmt); // release the read transaction but keep the statement
+}
+
+
+int ColumnReader::Bind(const std::vector<double> &params)
+{
+  int rc = steprc == SQLITE_ROW ? SQLITE_OK : steprc;
+  for (unsigned k = 0; k < params.size() && rc == SQLITE_OK; k++)
+    rc = sqlite3_bind_double(stmt, k + 1, params[k]);
+  return rc;
+}
+
+
+int ColumnReader::Read(columnset &cols, unsigned maxrows)
+{
+  if (steprc != SQLITE_ROW)
+    return steprc;
+  int ncol = ncols();
+  if (cols.vals.size() != (size_t)ncol)
+    cols.Reset(ncol);
+
+  for (unsigned n = 0; n < maxrows; n++)
+  {
+    steprc = sqlite3_step(stmt);
+    if (steprc != SQLITE_ROW)
+      break;
+    AppendRow(cols);
+  }
+  return steprc;
+}
+
+
+int ColumnReader::ReadRowid(columnset &cols, int param, sqlite3_int64 rowid)
+{
+  if (cols.vals.size() != (size_t)ncols())
+    cols.Reset(ncols());
+  sqlite3_reset(stmt);
+  steprc = sqlite3_bind_int64(stmt, param, rowid);
+  if (steprc != SQLITE_OK)
+    return steprc;
+  while ((steprc = sqlite3_step(stmt)) == SQLITE_ROW)
+    AppendRow(cols);
+  return steprc;
+}
+
+
+void ColumnReader::AppendRow(columnset &cols)
+{
+  for (unsigned c = 0; c < cols.vals.size(); c++)
+  {
+    if (cols.nrows == 0)
+      cols.isint[c] = intcol[c];
+    int type = sqlite3_column_type(stmt, c);
+    if (type == SQLITE_NULL)
     {
-      int col = i % ncol;
-      int row = floor(i / ncol);
-      if (result[ncol + i]) // skip column names
+      cols.vals[c].push_back(0.0);
+      cols.valid[c].push_back(0);
+      if (cols.isint[c])
+        cols.ivals[c].push_back(0);
+    }
+    else if (cols.isint[c] && type == SQLITE_INTEGER)
+    {
+      sqlite3_int64 ival = sqlite3_column_int64(stmt, c);
+      cols.vals[c].push_back((double)ival);
+      cols.valid[c].push_back(1);
+      cols.ivals[c].push_back(ival);
+    }
+    else
+    { // a REAL or TEXT value stored in a column with INTEGER affinity ends the integers
+      cols.vals[c].push_back(sqlite3_column_double(stmt, c));
+      cols.valid[c].push_back(1);
+      cols.isint[c] = 0;
+      if ((int)c == textcol && (type == SQLITE_TEXT || type == SQLITE_BLOB))
       {
-        std::string val(result[ncol + i]);
-        columns[col][row] = atof(val.c_str());
+        const char *text = (const char*)sqlite3_column_text(stmt, c);
+        cols.SetText(c, cols.nrows, std::string(text, sqlite3_column_bytes(stmt, c)));
       }
     }
   }
-  sqlite3_free_table(result);
+  cols.nrows++;
+}
+
+
+
+/* Worker threads of the pool wait for a new generation of tasks and then take tasks one at a
+time until none are left. The threads are started when first needed and are stopped and 
+started again if the number of pool threads is changed.
+*/
+class threadpool
+{
+public:
+  threadpool()
+  {
+    stop = false;
+    generation = 0;
+    ntasks = nexttask = pending = 0;
+  }
+  ~threadpool()
+  {
+    Resize(0);
+  }
+  void Run(int nthreads, int ntasks, std::function<void(int)> task);
+private:
+  void Resize(unsigned nworkers);
+  void WorkerLoop();
+  void Work();
+  std::vector<std::thread> workers;
+  std::mutex runmutex; // held while a query uses the pool
+  std::mutex mutex;
+  std::condition_variable wakeup, done;
+  bool stop;
+  unsigned generation;
+  std::function<void(int)> job;
+  int ntasks, nexttask, pending;
+};
+
+
+void threadpool::Resize(unsigned nworkers)
+{
+  if (workers.size() == nworkers)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  wakeup.notify_all();
+  for (unsigned t = 0; t < workers.size(); t++)
+    workers[t].join();
+  workers.clear();
+  stop = false;
+  for (unsigned t = 0; t < nworkers; t++)
+    workers.push_back(std::thread(&threadpool::WorkerLoop, this));
+}
+
+
+void threadpool::WorkerLoop()
+{
+  unsigned seen = 0;
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wakeup.wait(lock, [&]() { return stop || generation != seen; });
+      if (stop)
+        return;
+      seen = generation;
+    }
+    Work();
+  }
+}
+
+
+void threadpool::Work()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while (nexttask < ntasks)
+  {
+    int i = nexttask++;
+    lock.unlock();
+    job(i);
+    lock.lock();
+    if (--pending == 0)
+      done.notify_all();
+  }
+}
+
+
+void threadpool::Run(int nthreads, int ntasks, std::function<void(int)> task)
+{
+  std::unique_lock<std::mutex> busy(runmutex, std::try_to_lock);
+  if (!busy.owns_lock() || nthreads < 2 || ntasks < 2)
+  { // the pool is busy with another query or not needed
+    for (int i = 0; i < ntasks; i++)
+      task(i);
+    return;
+  }
+  Resize(nthreads - 1); // the calling thread is one of the threads
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    job = task;
+    this->ntasks = ntasks;
+    nexttask = 0;
+    pending = ntasks;
+    generation++;
+  }
+  wakeup.notify_all();
+  Work();
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [&]() { return pending == 0; });
+  job = nullptr;
+}
+
+
+static threadpool pool;
+
+
+void RunPoolTasks(int nthreads, int ntasks, std::function<void(int)> task)
+{
+  pool.Run(nthreads, ntasks, task);
+}
+
+
+int BinningThreads(unsigned nrows)
+{
+  if (nrows < PARALLELBINROWS)
+    return 1;
+  // give every thread at least a quarter of the threshold of rows
+  unsigned nthreads = nrows / (PARALLELBINROWS / 4);
+  return nthreads < (unsigned)histoconfig.poolthreads ? nthreads : histoconfig.poolthreads;
+}
+
+
+/* Scratch buffer for n bin indices owned by the calling thread. It is reused by every batch
+the thread bins so it is only allocated while it grows. Slot 1 is a second buffer for binning
+the y values of a batch along with its x values in slot 0.
+*/
+static int *IndexScratch(unsigned n, int slot = 0)
+{
+  static thread_local std::vector<int> scratch[2];
+  if (scratch[slot].size() < n)
+    scratch[slot].resize(n);
+  return scratch[slot].data();
+}
+
+
+/* Private bins for each of nthreads threads binning a batch in parallel taken from an arena
+of the calling thread that is reused by every batch. The bins of thread t start at t*stride.
+Each copy is followed by a cache line of unused bins so no two threads write to the same
+cache line.
+*/
+template<typename T>
+static T *PrivateBins(std::vector<T> &arena, int nthreads, int bins, unsigned *stride)
+{
+  *stride = bins + 64 / sizeof(T) + 1;
+  arena.assign((size_t)*stride * nthreads, T());
+  return arena.data();
+}
+
+
+// Rows from first up to last of the slice t of n rows split into nslices slices
+static void SliceRows(unsigned n, int t, int nslices, unsigned *first, unsigned *last)
+{
+  *first = (unsigned)((sqlite3_uint64)n * t / nslices);
+  *last = (unsigned)((sqlite3_uint64)n * (t + 1) / nslices);
+}
+
+
+
+columnset GetColumns(sqlite3* db, std::string sqlxprs, int *rc)
+{
+  // get all columns from sql expression and return them
+  columnset columns;
+  ColumnReader reader(db, sqlxprs, rc);
+  if (*rc != SQLITE_OK)
+    return columns;
+
+  columns.Reset(reader.ncols());
+  *rc = reader.Read(columns, 0xFFFFFFFF);
+  if (*rc == SQLITE_DONE)
+    *rc = SQLITE_OK;
 
   return columns;
 }
 
 
 
-/* Caclulate a histogram from the col array with bins number of bins and values between
-minbin and maxbin
+int RowidRange(sqlite3* db, std::string tblname, sqlite3_int64 *minrowid, 
+               sqlite3_int64 *maxrowid, bool *empty)
+{
+  // fails for views and WITHOUT ROWID tables
+  std::string s_exe = "SELECT min(rowid), max(rowid) FROM " + tblname;
+  int rc = SQLITE_OK;
+  sqlite3_stmt *stmt = GetCachedStmt(db, s_exe, &rc);
+  if (rc != SQLITE_OK)
+    return rc;
+  rc = sqlite3_step(stmt);
+  if (rc == SQLITE_ROW)
+  {
+    *empty = sqlite3_column_type(stmt, 0) == SQLITE_NULL;
+    *minrowid = sqlite3_column_int64(stmt, 0);
+    *maxrowid = sqlite3_column_int64(stmt, 1);
+    rc = SQLITE_OK;
+  }
+  sqlite3_reset(stmt);
+  return rc;
+}
+
+
+std::string RowidRangeSql(std::string selectxprs, std::string whereclause, 
+                          sqlite3_int64 lower, sqlite3_int64 upper)
+{
+  std::string s_exe = selectxprs + " WHERE rowid BETWEEN " + std::to_string(lower)
+    + " AND " + std::to_string(upper);
+  if (whereclause != "")
+    s_exe += " AND (" + whereclause + ")";
+  return s_exe;
+}
+
+
+// True if the SQL compiles on db
+static bool Compiles(sqlite3 *db, std::string sqlxprs)
+{
+  sqlite3_stmt *stmt = NULL;
+  int rc = sqlite3_prepare_v2(db, sqlxprs.c_str(), -1, &stmt, NULL);
+  sqlite3_finalize(stmt);
+  return rc == SQLITE_OK;
+}
+
+
+/* True if tblname, as quoted by QuoteTableName(), names a table of the main database. An 
+unqualified name is looked up in the temp database before main and in attached databases 
+after it.
 */
-std::vector<histobin> CalcHistogram(std::vector< std::vector<double> > Yvals, 
-                                     int bins, double minbin, double maxbin, int *rc)
+static bool MainSchemaTable(sqlite3 *db, std::string tblname)
 {
-  std::vector<histobin> histo;
+  std::string schema, table;
+  SplitTableName(tblname, &schema, &table);
+  if (schema != "")
+    return sqlite3_stricmp(schema.c_str(), QuoteId("main").c_str()) == 0
+      && Compiles(db, "SELECT 1 FROM main." + table);
+  return Compiles(db, "SELECT 1 FROM main." + table) 
+    && !Compiles(db, "SELECT 1 FROM temp." + table);
+}
 
-	if (bins < 1 || minbin >= maxbin)
-	{
-		std::cerr << "Nonsensical value for either bins, minbin or maxbin" << std::endl;
-		*rc = SQLITE_ERROR;
-		return histo;
-	}
 
-  histo.resize(bins);
-  double bindomain = maxbin - minbin;
-  double binwidth = bindomain / bins;
-  int accumcount = 0;
-  for (unsigned i = 0; i < histo.size(); i++)
+// True if the main database of db is in WAL mode
+static bool WalMode(sqlite3 *db)
+{
+  int rc = SQLITE_OK;
+  sqlite3_stmt *stmt = GetCachedStmt(db, "PRAGMA main.journal_mode", &rc);
+  bool wal = rc == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW
+    && sqlite3_stricmp((const char*)sqlite3_column_text(stmt, 0), "wal") == 0;
+  if (rc == SQLITE_OK)
+    sqlite3_reset(stmt);
+  return wal;
+}
+
+
+int ParallelReadBatches(sqlite3* db, std::string tblname, std::string selectxprs, 
+                        std::string whereclause, const std::vector<double> &params,
+                        int nthreads, std::function<void(int, const columnset &)> accumulate,
+                        int textcol)
+{
+  // worker connections need a database file to open and a thread safe SQLite library
+  const char *filename = sqlite3_db_filename(db, "main");
+  if (nthreads < 2 || filename == NULL || filename[0] == '\0' || !sqlite3_threadsafe())
+    return SQLITE_MISUSE;
+  /* Worker connections read the last committed state of the main database file. They
+  cannot see the uncommitted changes of a transaction open on db nor its temp and attached
+  tables so those are scanned serially.
+  */
+  if (!sqlite3_get_autocommit(db) || !MainSchemaTable(db, tblname))
+    return SQLITE_MISUSE;
+
+  sqlite3_int64 minrowid, maxrowid;
+  bool empty;
+  int rc = RowidRange(db, tblname, &minrowid, &maxrowid, &empty);
+  if (rc != SQLITE_OK || empty) // nothing to accumulate from an empty table
+    return rc;
+
+  sqlite3_uint64 nrowids = (sqlite3_uint64)(maxrowid - minrowid) + 1;
+  if (nrowids < (sqlite3_uint64)nthreads)
+    nthreads = (int)nrowids;
+  sqlite3_uint64 rangesize = nrowids / nthreads;
+
+  /* All workers must read the same snapshot but the snapshot functions are not exported to
+  loadable extensions. In rollback journal mode the shared lock of the first worker keeps 
+  writers from committing until the scan is done. In WAL mode readers do not block writers
+  so the write lock is held on another connection until every worker has started its read 
+  transaction. The table is scanned serially if that lock cannot be had right away.
+  */
+  sqlite3 *writer = NULL;
+  if (WalMode(db))
+  {
+    rc = sqlite3_open_v2(filename, &writer, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, NULL);
+    if (rc == SQLITE_OK)
+      rc = sqlite3_exec(writer, "BEGIN IMMEDIATE;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK)
+    {
+      sqlite3_close(writer);
+      return SQLITE_MISUSE;
+    }
+  }
+
+  std::vector<sqlite3*> conns(nthreads, (sqlite3*)NULL);
+  std::vector<std::string> sqls(nthreads);
+  for (int t = 0; t < nthreads && rc == SQLITE_OK; t++)
+  {
+    rc = sqlite3_open_v2(filename, &conns[t], SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL);
+    if (rc == SQLITE_OK)
+      rc = sqlite3_exec(conns[t], "BEGIN; SELECT count(*) FROM sqlite_master;", NULL, NULL, NULL);
+
+    sqlite3_int64 lower = minrowid + (sqlite3_int64)(rangesize * t);
+    sqlite3_int64 upper = (t == nthreads - 1) ? maxrowid : lower + (sqlite3_int64)rangesize - 1;
+    sqls[t] = RowidRangeSql(selectxprs, whereclause, lower, upper);
+  }
+  if (writer != NULL)
+  {
+    sqlite3_exec(writer, "ROLLBACK;", NULL, NULL, NULL);
+    sqlite3_close(writer);
+  }
+
+  std::vector<int> threadrc(nthreads, rc);
+  if (rc == SQLITE_OK)
+  {
+    std::vector<std::thread> workers;
+    for (int t = 0; t < nthreads; t++)
+    {
+      workers.push_back(std::thread([&, t]()
+      {
+        // worker connections are closed when done so do not cache their statements
+        ColumnReader reader(conns[t], sqls[t], &threadrc[t], textcol);
+        if (threadrc[t] == SQLITE_OK)
+          threadrc[t] = reader.Bind(params);
+        if (threadrc[t] != SQLITE_OK)
+          return;
+        threadrc[t] = ReadBatches(reader, [&](const columnset &batch)
+        {
+          accumulate(t, batch);
+        });
+      }));
+    }
+    for (unsigned t = 0; t < workers.size(); t++)
+      workers[t].join();
+  }
+
+  for (int t = 0; t < nthreads; t++)
+  {
+    if (threadrc[t] != SQLITE_OK)
+      rc = threadrc[t];
+    sqlite3_exec(conns[t], "COMMIT;", NULL, NULL, NULL);
+    sqlite3_close(conns[t]);
+  }
+  return rc;
+}
+
+
+
+int CheckBins(int bins, double minbin, double maxbin)
+{
+  if (bins < 1 || !(minbin < maxbin))
+  {
+    std::cerr << "Nonsensical value for either bins, minbin or maxbin" << std::endl;
+    return SQLITE_ERROR;
+  }
+  return SQLITE_OK;
+}
+
+
+bool IsBinEdges(sqlite3_value *val)
+{
+  if (sqlite3_value_type(val) == SQLITE_BLOB)
+    return true;
+  if (sqlite3_value_type(val) != SQLITE_TEXT)
+    return false;
+  const char *text = (const char*)sqlite3_value_text(val);
+  while (isspace((unsigned char)*text))
+    text++;
+  return *text == '[';
+}
+
+
+int ParseBinEdges(sqlite3_value *val, std::vector<double> *edges, std::string *errmsg)
+{
+  edges->clear();
+  if (sqlite3_value_type(val) == SQLITE_BLOB)
+  {
+    int nbytes = sqlite3_value_bytes(val);
+    if (nbytes % sizeof(double) != 0)
+    {
+      *errmsg = "the size of a BLOB of bin edges must be a multiple of 8 bytes";
+      return SQLITE_ERROR;
+    }
+    edges->resize(nbytes / sizeof(double));
+    if (nbytes > 0)
+      memcpy(edges->data(), sqlite3_value_blob(val), nbytes);
+    return SQLITE_OK;
+  }
+  const char *text = (const char*)sqlite3_value_text(val);
+  const char *p = text ? text : "";
+  while (isspace((unsigned char)*p))
+    p++;
+  bool ok = *p++ == '[';
+  while (ok)
+  {
+    while (isspace((unsigned char)*p))
+      p++;
+    if (*p == ']' && edges->empty())
+      break;
+    char *end = NULL;
+    double edge = strtod(p, &end);
+    ok = end != p;
+    if (!ok)
+      break;
+    edges->push_back(edge);
+    p = end;
+    while (isspace((unsigned char)*p))
+      p++;
+    if (*p == ']')
+      break;
+    ok = *p++ == ',';
+  }
+  if (ok)
+  { // nothing but white space may follow the closing bracket
+    p++;
+    while (isspace((unsigned char)*p))
+      p++;
+    ok = *p == 0;
+  }
+  if (!ok)
+  {
+    *errmsg = std::string("bin edges must be a JSON array of numbers or a BLOB of doubles: ") 
+      + (text ? text : "NULL");
+    return SQLITE_ERROR;
+  }
+  return SQLITE_OK;
+}
+
+
+int ParseBinScale(sqlite3_value *val, double *power, std::string *errmsg)
+{
+  *power = 1.0;
+  int type = sqlite3_value_type(val);
+  if (type == SQLITE_NULL)
+    return SQLITE_OK;
+  if (type == SQLITE_INTEGER || type == SQLITE_FLOAT)
+  {
+    *power = sqlite3_value_double(val);
+    if (std::isfinite(*power))
+      return SQLITE_OK;
+  }
+  std::string scale = type == SQLITE_TEXT ? (const char*)sqlite3_value_text(val) : "";
+  if (scale == "linear" || scale == "")
+    *power = 1.0;
+  else if (scale == "log")
+    *power = 0.0;
+  else if (scale == "sqrt")
+    *power = 0.5;
+  else
+  {
+    char *end = NULL;
+    *power = strtod(scale.c_str(), &end);
+    if (end == scale.c_str() || *end != 0 || !std::isfinite(*power))
+    {
+      *errmsg = "binscale must be 'linear', 'log', 'sqrt' or a power: " + scale;
+      return SQLITE_ERROR;
+    }
+  }
+  return SQLITE_OK;
+}
+
+
+std::string BinScaleName(double power)
+{
+  if (power == 1.0)
+    return "linear";
+  if (power == 0.0)
+    return "log";
+  if (power == 0.5)
+    return "sqrt";
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.17g", power);
+  return buf;
+}
+
+
+/* Set up a histogram with bins number of empty bins for values between minbin and maxbin
+*/
+void InitHistogram(histobin *histo, int bins, double minbin, double maxbin, 
+                   const binedges *edges)
+{
+  double binwidth = (maxbin - minbin) / bins;
+  for (int i = 0; i < bins; i++)
   {
-    double upper = binwidth * (i + 1) + minbin;
     double middle = binwidth * (i + 0.5) + minbin;
-    double lower = binwidth * i + minbin;
+    if (edges)
+      middle = edges->centers[i];
     histo[i].binval = middle;
     histo[i].count = 0;
     histo[i].accumcount = 0;
-    histo[i].accumcount = accumcount;
   }
+}
+
+
+/* Bin indices of the values of v into ibins. Integer values in bins with integer edges are
+binned with the integer kernels and any other values with the binning kernel. Bins of 
+variable width are looked up in their edges.
+*/
+static void ViewBinIndices(columnview v, int bins, double minbin, double maxbin, int *ibins,
+                           const binedges *edges = NULL)
+{
+  intbinning ib;
+  if (edges)
+    EdgeBinIndices(*edges, v.vals, v.n, ibins);
+  else if (v.ivals && IntBinning(minbin, maxbin, bins, &ib))
+    IntBinIndices(ib, v.ivals, v.n, ibins);
+  else
+    BinIndices(v.vals, v.n, minbin, maxbin, (maxbin - minbin) / bins, bins, ibins);
+}
+
+
+// Add the non-NULL values of y to the bins number of bin counts in counts
+static void CountBins(histobin *counts, int bins, columnview y, double minbin, double maxbin,
+                      const binedges *edges)
+{
+  intbinning ib;
+  if (!edges && y.ivals && (unsigned)bins <= y.n && IntBinning(minbin, maxbin, bins, &ib))
+  { // count integers straight into narrow counters unless there are more bins than values
+    CountIntBins(ib, y.ivals, y.valid, y.n, bins, counts);
+    return;
+  }
+  int *ibins = IndexScratch(y.n);
+  ViewBinIndices(y, bins, minbin, maxbin, ibins, edges);
+  for (unsigned j = 0; j < y.n; j++)
+  {
+    if (y.valid[j] && ibins[j] >= 0) // skip NULL values and values outside the bins
+      counts[ibins[j]].count++;
+  }
+}
+
+
+/* Add the non-NULL values of a batch of rows to the bin counts
+*/
+void AccumHistogram(histobin *histo, int bins, columnview y, double minbin, double maxbin,
+                    const binedges *edges)
+{
+  int nthreads = BinningThreads(y.n);
+  if (nthreads < 2)
+  {
+    CountBins(histo, bins, y, minbin, maxbin, edges);
+    return;
+  }
+  static thread_local std::vector<histobin> arena;
+  unsigned stride = 0;
+  histobin *partial = PrivateBins(arena, nthreads, bins, &stride);
+  RunPoolTasks(nthreads, nthreads, [&](int t)
+  { // bin a slice of the rows into the private bins of this thread
+    unsigned first, last;
+    SliceRows(y.n, t, nthreads, &first, &last);
+    CountBins(partial + t * stride, bins, y.Slice(first, last), minbin, maxbin, edges);
+  });
+  for (int t = 0; t < nthreads; t++)
+    MergeHistogram(histo, partial + t * stride, bins);
+}
+
+
+/* Add the non-NULL values of y of a batch of rows to histo1 if the corresponding
+value of discr is greater than or equal to discrval or else to histo2. 
+Rows where the discr value is NULL are not counted in either histogram.
+*/
+void AccumRatioHistogram(histobin *histo1, histobin *histo2, int bins, columnview y, 
+                         columnview discr, double discrval, double minbin, double maxbin,
+                         const binedges *edges)
+{
+  int *ibins = IndexScratch(y.n);
+  ViewBinIndices(y, bins, minbin, maxbin, ibins, edges);
+  for (unsigned j = 0; j < y.n; j++)
+  {
+    if (!y.valid[j] || !discr.valid[j]) // skip rows with NULL values
+      continue;
+    int ibin = ibins[j];
+    if (ibin < 0)
+      continue;
+    if (discr.vals[j] >= discrval)
+      histo1[ibin].count++;
+    else
+      histo2[ibin].count++;
+  }
+}
+
 
-  if (Yvals.size() > 0)
+/* Add the non-NULL values of y to the bin counters of the histogram of each row which starts
+at counts[offsets[j]] for row j. Rows with an offset of -1 are skipped.
+*/
+void AccumGroupedCounts(int *counts, int bins, const sqlite3_int64 *offsets, columnview y,
+                        double minbin, double maxbin, const binedges *edges)
+{
+  int *ibins = IndexScratch(y.n);
+  ViewBinIndices(y, bins, minbin, maxbin, ibins, edges);
+  for (unsigned j = 0; j < y.n; j++)
   {
-    for (unsigned j = 0; j < Yvals[0].size(); j++)
+    if (y.valid[j] && ibins[j] >= 0 && offsets[j] >= 0)
+      counts[offsets[j] + ibins[j]]++;
+  }
+}
+
+
+void AccumWeightedHistogram(histobin *histo, weightedbin *weights, int bins, columnview y,
+                            columnview w, double minbin, double maxbin, const binedges *edges)
+{
+  int *ibins = IndexScratch(y.n);
+  ViewBinIndices(y, bins, minbin, maxbin, ibins, edges);
+  for (unsigned j = 0; j < y.n; j++)
+  {
+    int ibin = ibins[j];
+    if (!y.valid[j] || ibin < 0)
+      continue;
+    histo[ibin].count++;
+    if (w.valid[j])
     {
-      int ibin = (Yvals[0][j] - minbin) / binwidth;
-      if (ibin < 0 || ibin >(bins - 1))
-        continue;
-      histo[ibin].count++;
-      accumcount++;
-      histo[ibin].accumcount = accumcount;
+      weights[ibin].sumw += w.vals[j];
+      weights[ibin].sumw2 += w.vals[j] * w.vals[j];
     }
   }
+}
 
-  return histo;
+
+void MergeWeights(weightedbin *weights, const weightedbin *partial, int bins)
+{
+  for (int i = 0; i < bins; i++)
+  {
+    weights[i].sumw += partial[i].sumw;
+    weights[i].sumw2 += partial[i].sumw2;
+  }
+}
+
+
+/* Add the bin counts of a partial histogram computed over some of the rows to histo
+*/
+void MergeHistogram(histobin *histo, const histobin *partial, int bins)
+{
+  for (int i = 0; i < bins; i++)
+    histo[i].count += partial[i].count;
+}
+
+
+/* Compute the accumulated counts once all values have been added to the histogram
+*/
+void FinalizeHistogram(histobin *histo, int bins)
+{
+  int accumcount = 0;
+  for (int i = 0; i < bins; i++)
+  {
+    accumcount += histo[i].count;
+    histo[i].accumcount = accumcount;
+  }
+}
+
+
+/* Caclulate a histogram of the values of y with bins number of bins between minbin and 
+maxbin into histo which must have room for bins bins
+*/
+int CalcHistogram(columnview y, histobin *histo, int bins, double minbin, double maxbin)
+{
+  int rc = CheckBins(bins, minbin, maxbin);
+  if (rc != SQLITE_OK)
+    return rc;
+
+  InitHistogram(histo, bins, minbin, maxbin);
+  AccumHistogram(histo, bins, y, minbin, maxbin);
+  FinalizeHistogram(histo, bins);
+  return SQLITE_OK;
 };
 
 
-/* Calculate interpolation values for scatter data within bin values between
-minbin and maxbin
+
+void InitGrid(grid2d &grid, int xbins, double xmin, double xmax, int ybins, double ymin,
+              double ymax)
+{
+  grid.xbins = xbins;
+  grid.xmin = xmin;
+  grid.xmax = xmax;
+  grid.ybins = ybins;
+  grid.ymin = ymin;
+  grid.ymax = ymax;
+  sqlite3_int64 ncells = (sqlite3_int64)xbins * ybins;
+  grid.dense = ncells <= MAXDENSECELLS;
+  grid.counts.assign(grid.dense ? ncells : 0, 0);
+  grid.sparse.clear();
+  grid.cells.clear();
+}
+
+
+/* Add the rows of a batch where both the x and the y value are inside the grid to the counts
+of their cells. Both columns are binned with the binning kernels before the cells are counted.
 */
-std::vector<interpolatebin> CalcInterpolations(std::vector< std::vector<double> > XYvals, 
-                                          int bins, double minbin, double maxbin, int *rc)
+void AccumGrid(grid2d &grid, columnview x, columnview y)
+{
+  int *ix = IndexScratch(x.n, 0);
+  int *iy = IndexScratch(y.n, 1);
+  ViewBinIndices(x, grid.xbins, grid.xmin, grid.xmax, ix);
+  ViewBinIndices(y, grid.ybins, grid.ymin, grid.ymax, iy);
+  for (unsigned j = 0; j < x.n; j++)
+  {
+    if (!x.valid[j] || !y.valid[j] || ix[j] < 0 || iy[j] < 0)
+      continue;
+    sqlite3_int64 cell = (sqlite3_int64)ix[j] * grid.ybins + iy[j];
+    if (grid.dense)
+      grid.counts[cell]++;
+    else
+      grid.sparse[cell]++;
+  }
+}
+
+
+void MergeGrid(grid2d &grid, const grid2d &partial)
+{
+  if (grid.dense)
+  {
+    for (size_t i = 0; i < grid.counts.size(); i++)
+      grid.counts[i] += partial.counts[i];
+  }
+  else
+  {
+    for (auto it = partial.sparse.begin(); it != partial.sparse.end(); ++it)
+      grid.sparse[it->first] += it->second;
+  }
+}
+
+
+void FinalizeGrid(grid2d &grid)
 {
-	std::vector<interpolatebin> interpol;
-	std::vector< std::vector<double> > shiftval;
+  grid.cells.assign(grid.sparse.begin(), grid.sparse.end());
+  std::sort(grid.cells.begin(), grid.cells.end());
+}
+
 
-	if (bins < 1 || minbin >= maxbin)
-	{
-		std::cerr << "Nonsensical value for either bins, minbin or maxbin" << std::endl;
-		*rc = SQLITE_ERROR;
-		return interpol;
-	}
+sqlite3_int64 GridRows(const grid2d &grid)
+{
+  return grid.dense ? (sqlite3_int64)grid.counts.size() : (sqlite3_int64)grid.cells.size();
+}
 
-  shiftval.resize(2);
-  shiftval[0].resize(bins);
-  shiftval[1].resize(bins);
 
-  interpol.resize(bins);
-  double bindomain = maxbin - minbin;
-  double binwidth = bindomain / bins;
-  if (XYvals.size() < 1)
-    return interpol;
+void GridRow(const grid2d &grid, sqlite3_int64 r, double *xval, double *yval, int *count)
+{
+  sqlite3_int64 cell = grid.dense ? r : grid.cells[r].first;
+  *count = grid.dense ? grid.counts[r] : grid.cells[r].second;
+  double xwidth = (grid.xmax - grid.xmin) / grid.xbins;
+  double ywidth = (grid.ymax - grid.ymin) / grid.ybins;
+  *xval = xwidth * (cell / grid.ybins + 0.5) + grid.xmin;
+  *yval = ywidth * (cell % grid.ybins + 0.5) + grid.ymin;
+}
 
-  for (unsigned i = 0; i < interpol.size(); i++)
+
+
+void sparsebins::Clear()
+{
+  keys.clear();
+  counts.clear();
+  nused = 0;
+  shift = 64;
+}
+
+
+// Double the number of slots and insert the occupied bins again
+void sparsebins::Grow()
+{
+  std::vector<int> oldkeys, oldcounts;
+  oldkeys.swap(keys);
+  oldcounts.swap(counts);
+  size_t nslots = oldkeys.empty() ? 1024 : 2 * oldkeys.size();
+  keys.assign(nslots, -1);
+  counts.assign(nslots, 0);
+  shift = 64;
+  for (size_t n = nslots; n > 1; n >>= 1)
+    shift--;
+  nused = 0;
+  for (size_t s = 0; s < oldkeys.size(); s++)
   {
-    double upper = binwidth * (i + 1) + minbin;
-    double middle = binwidth * (i + 0.5) + minbin;
-    double lower = binwidth * i + minbin;
-    interpol[i].xval = middle;
-    interpol[i].count = 0;
+    if (oldkeys[s] >= 0)
+      Add(oldkeys[s], oldcounts[s]);
   }
+}
 
-  for (unsigned j = 0; j < XYvals[0].size(); j++)
+
+void sparsebins::Add(int bin, int count)
+{
+  if ((nused + 1) * 4 > keys.size() * 3) // keep the table at most three quarters full
+    Grow();
+  size_t mask = keys.size() - 1;
+  size_t s = Slot(bin);
+  while (keys[s] != bin)
   {
-    int ibin = (XYvals[0][j] - minbin) / binwidth;
-    if (ibin < 0 || ibin >(bins - 1))
-      continue;
-    interpol[ibin].count++;
-    shiftval[0][ibin] = shiftval[1][ibin] = 0.0;
+    if (keys[s] < 0)
+    {
+      keys[s] = bin;
+      nused++;
+      break;
+    }
+    s = (s + 1) & mask;
+  }
+  counts[s] += count;
+}
+
+
+void sparsebins::Merge(const sparsebins &other)
+{
+  for (size_t s = 0; s < other.keys.size(); s++)
+  {
+    if (other.keys[s] >= 0)
+      Add(other.keys[s], other.counts[s]);
+  }
+}
+
+
+void sparsebins::Sorted(std::vector< std::pair<int, int> > &bins) const
+{
+  bins.clear();
+  bins.reserve(nused);
+  for (size_t s = 0; s < keys.size(); s++)
+  {
+    if (keys[s] >= 0)
+      bins.push_back(std::make_pair(keys[s], counts[s]));
   }
+  std::sort(bins.begin(), bins.end());
+}
 
-  for (unsigned j = 0; j < XYvals[0].size(); j++)
+
+void AccumSparseHistogram(sparsebins &sparse, int bins, columnview y, double minbin,
+                          double maxbin, const binedges *edges)
+{
+  int *ibins = IndexScratch(y.n);
+  ViewBinIndices(y, bins, minbin, maxbin, ibins, edges);
+  for (unsigned j = 0; j < y.n; j++)
+  {
+    if (y.valid[j] && ibins[j] >= 0)
+      sparse.Add(ibins[j]);
+  }
+}
+
+
+void FinalizeSparseHistogram(const sparsebins &sparse, std::vector<histobin> &histo, int bins,
+                             double minbin, double maxbin, const binedges *edges)
+{
+  std::vector< std::pair<int, int> > occupied;
+  sparse.Sorted(occupied);
+  double binwidth = (maxbin - minbin) / bins;
+  int accumcount = 0;
+  for (size_t i = 0; i < occupied.size(); i++)
+  {
+    int ibin = occupied[i].first;
+    double middle = edges ? edges->centers[ibin] : binwidth * (ibin + 0.5) + minbin;
+    accumcount += occupied[i].second;
+    histo.push_back(histobin(middle, occupied[i].second, accumcount));
+  }
+}
+
+
+
+/* Set up bins number of empty interpolation bins for x values between minbin and maxbin
+*/
+void InitInterpolations(interpolatebin *interpol, int bins, double minbin, double maxbin,
+                        const binedges *edges)
+{
+  double binwidth = (maxbin - minbin) / bins;
+  for (int i = 0; i < bins; i++)
+  {
+    double middle = edges ? edges->centers[i] : binwidth * (i + 0.5) + minbin;
+    interpol[i] = interpolatebin(middle);
+  }
+}
+
+
+// Add the x,y values of the rows of a batch to the bins number of interpolation bins
+static void AccumInterpolationRows(interpolatebin *interpol, int bins, columnview x, 
+                                   columnview y, double minbin, double maxbin,
+                                   const binedges *edges)
+{
+  int *ibins = IndexScratch(x.n);
+  ViewBinIndices(x, bins, minbin, maxbin, ibins, edges);
+  for (unsigned j = 0; j < x.n; j++)
   {
-    int ibin = (XYvals[0][j] - minbin) / binwidth;
-    if (ibin < 0 || ibin >(bins - 1))
+    if (!x.valid[j] || !y.valid[j]) // skip rows with NULL values
       continue;
-    // First calculate shiftconst used for avoiding numerical instability of sigma
-    // by assigning it to the mean value of values in the bin.
-    // See https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance#Algorithm_II
-    double shiftconst = 0.0;
-    if (interpol[ibin].count)
-      shiftconst = XYvals[1][j]/interpol[ibin].count;
+    int ibin = ibins[j];
+    if (ibin < 0)
+      continue;
+    interpolatebin &b = interpol[ibin];
+    double yval = y.vals[j];
+    b.count++;
+    double delta = yval - b.yval;
+    b.yval += delta / b.count;
+    b.M2 += delta * (yval - b.yval);
+  }
+}
+
 
-    double shifted = XYvals[1][j] - shiftconst;
-    shiftval[0][ibin] += shifted; // avoid numerical instability close to zero
-    shiftval[1][ibin] += shifted * shifted;
-    interpol[ibin].yval += XYvals[1][j];
+/* Add a batch of x,y values to the interpolation bins. 
+The mean and the sum of squared deviations from the mean are updated in a single pass 
+with Welford's algorithm to avoid numerical instability of sigma.
+See https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance#Welford's_online_algorithm
+*/
+void AccumInterpolations(interpolatebin *interpol, int bins, columnview x, columnview y,
+                         double minbin, double maxbin, const binedges *edges)
+{
+  int nthreads = BinningThreads(x.n);
+  if (nthreads < 2)
+  {
+    AccumInterpolationRows(interpol, bins, x, y, minbin, maxbin, edges);
+    return;
   }
+  // bin slices of the rows into the private bins of each thread and merge them
+  static thread_local std::vector<interpolatebin> arena;
+  unsigned stride = 0;
+  interpolatebin *partial = PrivateBins(arena, nthreads, bins, &stride);
+  RunPoolTasks(nthreads, nthreads, [&](int t)
+  {
+    unsigned first, last;
+    SliceRows(x.n, t, nthreads, &first, &last);
+    AccumInterpolationRows(partial + t * stride, bins, x.Slice(first, last), 
+      y.Slice(first, last), minbin, maxbin, edges);
+  });
+  for (int t = 0; t < nthreads; t++)
+    MergeInterpolations(interpol, partial + t * stride, bins);
+}
+
 
-  for (unsigned i = 0; i < interpol.size(); i++)
+/* Add the mean and sum of squared deviations of the partial interpolation bins computed over
+some of the rows to interpol with the formula of Chan et al. for combining them
+*/
+void MergeInterpolations(interpolatebin *interpol, const interpolatebin *partial, int bins)
+{
+  for (int i = 0; i < bins; i++)
   {
-    interpol[i].yval /= interpol[i].count;
-    interpol[i].sigma = sqrt((shiftval[1][i]
-      - (shiftval[0][i] * shiftval[0][i]) / interpol[i].count) / interpol[i].count);
+    interpolatebin &a = interpol[i];
+    const interpolatebin &b = partial[i];
+    if (b.count == 0)
+      continue;
+    int count = a.count + b.count;
+    double delta = b.yval - a.yval;
+    a.yval += delta * b.count / count;
+    a.M2 += b.M2 + delta * delta * ((double)a.count * b.count / count);
+    a.count = count;
+  }
+}
+
+
+/* Compute sigma and sem once all values have been added to the interpolation bins
+*/
+void FinalizeInterpolations(interpolatebin *interpol, int bins)
+{
+  for (int i = 0; i < bins; i++)
+  {
+    if (interpol[i].count == 0)
+    { // no values in this bin so mean and sigma are undefined
+      interpol[i].yval = interpol[i].sigma = interpol[i].sem = NAN;
+      continue;
+    }
+    interpol[i].sigma = sqrt(interpol[i].M2 / interpol[i].count);
     /*
     Margin of Error (MOE) of a mean value is based on Z*sigma/sqrt(N) Z=1.96 corresponds to 95% confidence
     Z-Score Confidence Limit (%)
@@ -218,7 +1413,21 @@ std::vector<interpolatebin> CalcInterpolations(std::vector< std::vector<double>
     */
     interpol[i].sem = interpol[i].sigma / sqrt(interpol[i].count);
   }
-
-  return interpol;
 }
 
+
+/* Calculate interpolation values for scatter data within bin values between
+minbin and maxbin into interpol which must have room for bins bins
+*/
+int CalcInterpolations(columnview x, columnview y, interpolatebin *interpol, int bins,
+                       double minbin, double maxbin)
+{
+  int rc = CheckBins(bins, minbin, maxbin);
+  if (rc != SQLITE_OK)
+    return rc;
+
+  InitInterpolations(interpol, bins, minbin, maxbin);
+  AccumInterpolations(interpol, bins, x, y, minbin, maxbin);
+  FinalizeInterpolations(interpol, bins);
+  return SQLITE_OK;
+}
@@ -27,6 +27,10 @@ SOFTWARE.
 
 #include <iostream>
 #include <vector>
+#include <string>
+#include <functional>
+#include <unordered_map>
+#include <thread>
 #include <cstdlib>
 #include <math.h>
 
@@ -48,28 +52,849 @@ struct histobin
 };
 
 
+/* Sums of the weights and of the squared weights of the rows in a bin of a weighted 
+histogram. The statistical error of the sum of weights of the bin is sqrt(sumw2).
+*/
+struct weightedbin
+{
+  double sumw, sumw2;
+  weightedbin() : sumw(0.0), sumw2(0.0) {}
+};
+
+
 struct interpolatebin
 {
   double xval, yval, sigma, sem;
+  double M2; // sum of squared deviations from yval while accumulating values
   int count;
   interpolatebin(double x = 0, double y = 0, double s = 0, int c = 0)
   {
     xval = x;
     yval = y;
     count = c;
+    M2 = 0.0;
     sem = sigma = 0.0; // Standard Error of Mean (SEM) is sigma/sqrt(N)
     // Margin of error is then Z*sigma/sqrt(N) for a given Z score
   }
 };
 
 
-std::vector< std::vector<double> > GetColumns(sqlite3* db, std::string sqlxprs, int *rc);
+/* Index of the bin that val falls into for bins number of bins of width binwidth 
+between minbin and maxbin. Bin i holds the values where val - minbin lies in 
+[i*binwidth, (i+1)*binwidth). The index is found by multiplying with invwidth, the reciprocal 
+of binwidth, rather than dividing by binwidth. As the reciprocal is rounded the index is then 
+corrected by one if the value lies on the other side of an edge of the bin. The binning 
+kernels in binkernels.cpp perform the same operations so they give identical bin indices.
+No product is added to anything so a compiler contracting into FMA instructions cannot 
+change the rounding of either.
+Returns -1 if val is outside [minbin, maxbin) or is NaN.
+*/
+inline int BinIndex(double val, double minbin, double maxbin, double binwidth, double invwidth,
+                    int bins)
+{
+  if (!(val >= minbin && val < maxbin))
+    return -1;
+  double diff = val - minbin;
+  int ibin = (int)(diff * invwidth);
+  if (ibin > bins - 1)
+    ibin = bins - 1;
+  if (ibin > 0 && diff < ibin * binwidth)
+    ibin--;
+  else if (ibin < bins - 1 && diff >= (ibin + 1) * binwidth)
+    ibin++;
+  return ibin;
+}
+
+
+/* Bin indices of n values computed with BinIndex(vals[j], ...) into ibins[j]. This points to 
+the fastest of the SIMD kernels in binkernels.cpp that the CPU supports once SelectBinKernel()
+has been called and to a scalar loop before that.
+*/
+typedef void(*binkernel)(const double *vals, unsigned n, double minbin, double maxbin,
+  double binwidth, int bins, int *ibins);
+extern binkernel BinIndices;
+
+/* Instruction set levels of the binning kernels */
+enum BinKernelLevels
+{
+  BINKERNEL_SCALAR = 0,
+  BINKERNEL_SSE2 = 1,
+  BINKERNEL_AVX2 = 2,
+  BINKERNEL_AVX512 = 3
+};
+
+/* Point BinIndices to the kernel of the highest level up to maxlevel that the CPU supports
+and return that level
+*/
+int SelectBinKernel(int maxlevel);
+
+
+/* Integer columns binned into bins of integer width are binned with integer arithmetic.
+The offset of a value from minbin is divided by the bin width with a shift if the width is
+a power of two, with a multiplication by a precomputed reciprocal if the offsets fit in 
+31 bits or else with an integer division. This gives the same bin indices as BinIndex()
+as the offsets and bin edges are exact in both.
+*/
+enum IntBinMethods
+{
+  INTBIN_SHIFT = 0,
+  INTBIN_MULHI = 1,
+  INTBIN_DIVIDE = 2
+};
+
+struct intbinning
+{
+  int method; // see IntBinMethods
+  bool wide; // offsets need 64 bits rather than 32 bits
+  sqlite3_int64 minbin;
+  sqlite3_uint64 range; // maxbin - minbin
+  sqlite3_uint64 width;
+  unsigned shift;
+  sqlite3_uint64 magic; // reciprocal of width for INTBIN_MULHI
+};
+
+/* Set up ib for binning integers with bins number of bins between minbin and maxbin. 
+Returns false if minbin or maxbin is not an integer or the bin width is not an integer.
+*/
+bool IntBinning(double minbin, double maxbin, int bins, intbinning *ib);
+// Bin indices of n integers into ibins[j] which is -1 for integers outside the bins
+void IntBinIndices(const intbinning &ib, const sqlite3_int64 *vals, unsigned n, int *ibins);
+// Add the valid integers of n values to the counts of bins number of bins in histo
+void CountIntBins(const intbinning &ib, const sqlite3_int64 *vals, const unsigned char *valid,
+  unsigned n, int bins, histobin *histo);
+
+
+/* Bins of variable width between ascending edges where bin i holds the values in
+[edges[i], edges[i+1]). The range between the first and the last edge is divided into cells
+of equal width and lookup[c] is the bin holding the lower end of cell c. A value is binned
+by looking up the bin of its cell and then comparing it with the one or two edges inside
+that cell, rather than with a binary search of all the edges. There are enough cells for the
+narrowest bin to be at least as wide as a cell up to MAXEDGECELLS cells.
+Positive edges spanning many orders of magnitude would need too many cells of equal width.
+Their cells are instead the values sharing the exponent and the leading mantissa bits of 
+the double, found from the bits of a value shifted right by cellshift, so every octave 
+has the same number of cells as on a logarithmic scale without calling log().
+centers[i] is the value reported for bin i.
+*/
+const int MAXEDGECELLS = 1 << 16;
+
+struct binedges
+{
+  std::vector<double> edges;
+  std::vector<double> centers;
+  std::vector<int> lookup;
+  double invcellwidth; // cells of equal width if cellshift is 0
+  int cellshift;
+  sqlite3_uint64 firstcell; // shifted bits of the first edge
+  int bins() const { return (int)edges.size() - 1; }
+};
+
+/* Set up be with the bin edges in edges. Returns SQLITE_ERROR with a message in errmsg if
+there are fewer than two edges or they are not finite and strictly ascending.
+*/
+int SetBinEdges(binedges &be, const std::vector<double> &edges, std::string *errmsg);
+/* Read bin edges given either as a JSON array of numbers such as '[0, 1.5, 2, 4]' or as a
+BLOB of doubles in the byte order of the machine. Returns SQLITE_ERROR with a message in
+errmsg if val is neither.
+*/
+int ParseBinEdges(sqlite3_value *val, std::vector<double> *edges, std::string *errmsg);
+// True if val is a BLOB or a TEXT starting with '[' that ParseBinEdges should read
+bool IsBinEdges(sqlite3_value *val);
+
+/* Bins of equal width in log(x) or in x^power between minbin and maxbin are bins of 
+variable width in x. The scale is given as 'linear', 'log', 'sqrt' or a number which is the 
+power, with log taken as power 0. NULL is linear. Returns SQLITE_ERROR with a message in 
+errmsg for any other value.
+*/
+int ParseBinScale(sqlite3_value *val, double *power, std::string *errmsg);
+// Name of the scale of power as taken by ParseBinScale
+std::string BinScaleName(double power);
+/* Set up be with bins bins of equal width in log(x) for power 0 or in x^power otherwise and
+their centers in the middle of each bin on that scale, which is the geometric mean of the 
+edges of a logarithmic bin. minbin must be positive except for positive powers where it
+may be 0. Returns SQLITE_ERROR with a message in errmsg otherwise.
+*/
+int ScaledBinEdges(binedges &be, int bins, double minbin, double maxbin, double power,
+  std::string *errmsg);
+// x on the scale of power as in ScaledBinEdges and back
+inline double ScaleValue(double x, double power) { return power == 0.0 ? log(x) : pow(x, power); }
+inline double UnscaleValue(double t, double power) { return power == 0.0 ? exp(t) : pow(t, 1.0 / power); }
+// Bin indices of n values into ibins[j] which is -1 for values outside the edges or NaN
+void EdgeBinIndices(const binedges &be, const double *vals, unsigned n, int *ibins);
+
+
+/* Column values of a query result stored in contiguous typed buffers.
+vals[c][r] is the value of column c in row r. The validity mask valid[c][r] is 0 
+if that value is NULL in which case vals[c][r] is 0.0
+Columns declared with INTEGER affinity are also kept as integers in ivals[c] as long as
+isint[c] is 1, that is while every non-NULL value of the column in the set is an integer.
+TEXT and BLOB values of a group column are also kept as text for grouping rows. TextId(c, r) 
+is the index into texts[c] of the value in row r or -1 if it is not a kept TEXT or BLOB value. 
+*/
+struct columnset
+{
+  std::vector< std::vector<double> > vals;
+  std::vector< std::vector<unsigned char> > valid;
+  std::vector< std::vector<sqlite3_int64> > ivals;
+  std::vector<unsigned char> isint;
+  std::vector< std::vector<std::string> > texts; // distinct texts of each column
+  std::vector< std::vector<int> > textid; // only as long as the last row with a text
+  std::vector< std::unordered_map<std::string, int> > textindex;
+  unsigned nrows;
+  columnset(int ncols = 0)
+  {
+    Reset(ncols);
+  }
+  void Reset(int ncols)
+  {
+    vals.resize(ncols);
+    valid.resize(ncols);
+    ivals.resize(ncols);
+    isint.resize(ncols);
+    texts.resize(ncols);
+    textid.resize(ncols);
+    textindex.resize(ncols);
+    Clear();
+  }
+  void Clear()
+  {
+    for (unsigned c = 0; c < vals.size(); c++)
+    {
+      vals[c].clear();
+      valid[c].clear();
+      ivals[c].clear();
+      isint[c] = 0;
+      if (!textid[c].empty())
+      {
+        texts[c].clear();
+        textid[c].clear();
+        textindex[c].clear();
+      }
+    }
+    nrows = 0;
+  }
+  int TextId(unsigned c, unsigned r) const
+  {
+    return r < textid[c].size() ? textid[c][r] : -1;
+  }
+  // Set the text of column c in row r which is at most the row being appended
+  void SetText(unsigned c, unsigned r, const std::string &text)
+  {
+    if (textid[c].size() <= r)
+      textid[c].resize(r + 1, -1);
+    auto found = textindex[c].emplace(text, (int)texts[c].size());
+    if (found.second)
+      texts[c].push_back(text);
+    textid[c][r] = found.first->second;
+  }
+  // Append row j of src which must have the same number of columns
+  void AppendRow(const columnset &src, unsigned j)
+  {
+    for (unsigned c = 0; c < vals.size(); c++)
+    {
+      vals[c].push_back(src.vals[c][j]);
+      valid[c].push_back(src.valid[c][j]);
+      if (nrows == 0)
+        isint[c] = src.isint[c];
+      if (isint[c] && src.isint[c])
+        ivals[c].push_back(src.ivals[c][j]);
+      else
+        isint[c] = 0;
+      int id = src.TextId(c, j);
+      if (id >= 0)
+        SetText(c, nrows, src.texts[c][id]);
+    }
+    nrows++;
+  }
+  // Overwrite row i with row j of src which must have the same number of columns
+  void SetRow(unsigned i, const columnset &src, unsigned j)
+  {
+    for (unsigned c = 0; c < vals.size(); c++)
+    {
+      vals[c][i] = src.vals[c][j];
+      valid[c][i] = src.valid[c][j];
+      if (isint[c] && src.isint[c])
+        ivals[c][i] = src.ivals[c][j];
+      else
+        isint[c] = 0;
+      int id = src.TextId(c, j);
+      if (id >= 0)
+        SetText(c, i, src.texts[c][id]);
+      else if (i < textid[c].size())
+        textid[c][i] = -1;
+    }
+  }
+};
+
+
+/* Non-owning view of n values of a column and their validity flags such as a column of a 
+columnset or a slice of one. The histogram functions read their input through views and
+count into bins provided by the caller so they never copy values or allocate bins themselves.
+*/
+struct columnview
+{
+  const double *vals;
+  const unsigned char *valid; // 0 for NULL values
+  const sqlite3_int64 *ivals; // the values as integers or 0 if they are not all integers
+  unsigned n;
+  columnview(const double *v, const unsigned char *isvalid, unsigned len,
+    const sqlite3_int64 *iv = 0) : vals(v), valid(isvalid), ivals(iv), n(len) {}
+  // Column col of cols or an empty view if there is no such column
+  columnview(const columnset &cols, unsigned col) : vals(0), valid(0), ivals(0), n(0)
+  {
+    if (col >= cols.vals.size())
+      return;
+    vals = cols.vals[col].data();
+    valid = cols.valid[col].data();
+    if (cols.isint[col])
+      ivals = cols.ivals[col].data();
+    n = cols.nrows;
+  }
+  columnview Slice(unsigned first, unsigned last) const
+  {
+    return columnview(vals + first, valid + first, last - first, ivals ? ivals + first : 0);
+  }
+};
+
+
+/* The virtual table object of HISTO, RATIOHISTO and MEANHISTO. It remembers the
+database connection so the statement cache of the connection can be released when the 
+virtual table is disconnected.
+*/
+struct histo_vtab
+{
+  sqlite3_vtab base;  /* Base class - must be first */
+  sqlite3 *db;
+};
+
+
+/* The query plan passed from xBestIndex to xFilter in idxNum. The lower byte is the column
+number of the last required argument found. Bit flags above it tell which optional 
+arguments are present. xFilter receives the required arguments first followed by the 
+optional arguments in the order of these flags.
+*/
+enum OptionalArgs
+{
+  ARG_WHERE = 0x100,
+  ARG_SAMPLE = 0x200,
+  ARG_GROUP = 0x400,
+  ARG_BINSCALE = 0x800,
+  ARG_SPARSE = 0x1000,
+  ARG_WEIGHT = 0x2000,
+  ARG_COLIN = 0x4000 // the column names come from an IN list read with sqlite3_vtab_in_first()
+};
+
+// True if SQLite can hand an IN constraint over to xFilter all at once, since version 3.38.0
+inline bool HasVtabIn() { return sqlite3_libversion_number() >= 3038000; }
+
+inline int RequiredArgs(int idxNum) { return idxNum & 0xFF; }
+
+
+// Quote a table or column name for generated SQL by enclosing it in double quotes
+std::string QuoteId(std::string name);
+
+// Split an optional schema prefix as in "main.tbl" off tblname. schema is empty if there is none
+void SplitTableName(std::string tblname, std::string *schema, std::string *table);
+// Quote the table name and the optional schema prefix of tblname separately
+std::string QuoteTableName(std::string tblname);
+
+// Split a comma separated list of column names and strip the spaces around each name
+std::vector<std::string> SplitColumnList(std::string colids);
+
+/* Join the values of an IN constraint handed to xFilter all at once into a comma separated
+list of column names as SplitColumnList() takes. SQLite passes the values in ascending order.
+*/
+int JoinInList(sqlite3_value *inlist, std::string *colids, std::string *errmsg);
+
+/* Check that tblname is a table or view and that the non-empty names in colids are columns
+of it. tblname may be prefixed with a schema name. The names can then be quoted with 
+QuoteTableName() and QuoteId() in the generated SQL rather than pasted into it verbatim. Returns SQLITE_OK or else SQLITE_ERROR with a message in errmsg.
+*/
+int CheckColumns(sqlite3 *db, std::string tblname, const std::vector<std::string> &colids,
+  std::string *errmsg);
+
+
+/* SQL for selecting the comma separated columns of tblname for the rows satisfying the 
+optional whereclause
+*/
+std::string SelectSql(std::string columns, std::string tblname, std::string whereclause);
+
+/* WHERE clause restricting the values of the binned column colid to [?1, ?2) combined with
+the optional whereclause. Binding minbin and maxbin to ?1 and ?2 lets SQLite skip rows 
+outside the histogram range or use an index range scan on colid if there is an index.
+*/
+std::string BinRangeClause(std::string colid, std::string whereclause);
+/* WHERE clause for binning several columns in one scan which skips the rows where none of
+the quoted colids has a value in [?1, ?2)
+*/
+std::string BinRangeClause(const std::vector<std::string> &colids, std::string whereclause);
+
+// The EXPLAIN QUERY PLAN details of sqlxprs telling whether a table or an index is scanned
+std::string QueryPlan(sqlite3* db, std::string sqlxprs);
+
+
+/* Per connection cache of prepared statements for the generated histogram queries so
+repeated calls on the same table and columns skip parsing and planning the SQL.
+Statements are keyed by their SQL text and are finalized when the schema changes.
+Every virtual table connected to db holds a reference to the cache of db.
+*/
+void AcquireStmtCache(sqlite3 *db);
+void ReleaseStmtCache(sqlite3 *db);
+// Return a reset statement for sqlxprs from the cache of db, preparing it if needed
+sqlite3_stmt *GetCachedStmt(sqlite3 *db, std::string sqlxprs, int *rc);
+
+
+/* Steps through the rows of a prepared statement and stores the values with 
+sqlite3_column_double() straight into a columnset. This avoids the text conversion
+of every value that sqlite3_get_table() does. Values of result columns that are table 
+columns declared with INTEGER affinity are read with sqlite3_column_int64() and are also
+stored in the integer buffers of the columnset.
+*/
+class ColumnReader
+{
+public:
+  /* prepare sqlxprs and finalize it when done. The TEXT and BLOB values of column textcol
+  are kept as text for grouping rows, those of other columns only as numbers
+  */
+  ColumnReader(sqlite3* db, std::string sqlxprs, int *rc, int textcol = -1);
+  // read from a cached statement which is reset rather than finalized when done
+  ColumnReader(sqlite3_stmt *cachedstmt, int textcol = -1);
+  ~ColumnReader();
+  int ncols() { return stmt ? sqlite3_column_count(stmt) : 0; }
+  // Bind params to the SQL parameters ?1, ?2, ... of the statement
+  int Bind(const std::vector<double> &params);
+  // Append at most maxrows rows to cols. Returns SQLITE_ROW if there are more rows
+  // to read, SQLITE_DONE if all rows have been read or else an error code
+  int Read(columnset &cols, unsigned maxrows);
+  // Rerun the statement with rowid bound to SQL parameter param and append its rows to 
+  // cols. Returns SQLITE_DONE on success or else an error code
+  int ReadRowid(columnset &cols, int param, sqlite3_int64 rowid);
+private:
+  void AppendRow(columnset &cols);
+  void FindIntegerColumns();
+  sqlite3_stmt *stmt;
+  std::vector<unsigned char> intcol; // 1 for columns with INTEGER affinity
+  bool owned;
+  int steprc;
+  int textcol; // column whose texts are kept or -1 for none
+};
+
+
+// Number of rows read from the database at a time when streaming values into bins
+const unsigned BATCHSIZE = 8192;
+
+
+/* Run time settings of the extension which are changed from SQL with 
+HISTOCONFIG('name', value) and read with HISTOCONFIG('name')
+*/
+struct histosettings
+{
+  int scanthreads; // number of threads scanning a table in parallel, 1 is a serial scan
+  int sampleseed; // seed for drawing random samples of rows, 0 seeds from the clock
+  int binkernel; // instruction set level of the binning kernel, see BinKernelLevels
+  int poolthreads; // number of threads binning large batches of values, 1 bins them serially
+  histosettings()
+  {
+    scanthreads = 1;
+    sampleseed = 0;
+    binkernel = BINKERNEL_SCALAR;
+    poolthreads = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+  }
+};
+
+extern histosettings histoconfig;
+
+// Pointer to the setting with a given name and its smallest allowed value in minval
+// or NULL if there is no such setting
+int *HistoSetting(std::string name, int *minval);
+
+
+/* Batches with at least this many rows are binned in parallel by the threads of a persistent 
+thread pool owned by the extension. Each thread bins a slice of the rows into private bins
+which are merged into the histogram at the end. Smaller batches are binned serially as 
+starting the threads would cost more than it saves.
+*/
+const unsigned PARALLELBINROWS = 65536;
+
+/* Run task(i) for i = 0, ..., ntasks-1 on nthreads threads of the pool including the calling 
+thread and return when all tasks are done. The tasks are run serially on the calling thread
+if another query is using the pool.
+*/
+void RunPoolTasks(int nthreads, int ntasks, std::function<void(int)> task);
+
+// Number of pool threads to bin nrows rows with, 1 if they should be binned serially
+int BinningThreads(unsigned nrows);
+
+
+columnset GetColumns(sqlite3* db, std::string sqlxprs, int *rc);
+
+
+/* Pass the result rows of reader in batches of at most BATCHSIZE rows to 
+accumulate(const columnset &batch) so memory use does not grow with the number of rows.
+Returns SQLITE_OK when all rows have been read or else an error code.
+*/
+template<typename Accumulator>
+int ReadBatches(ColumnReader &reader, Accumulator accumulate)
+{
+  int rc = SQLITE_OK;
+  columnset batch(reader.ncols());
+  do
+  {
+    batch.Clear();
+    rc = reader.Read(batch, BATCHSIZE);
+    accumulate(batch);
+  } while (rc == SQLITE_ROW);
+
+  return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+
+// As above for the rows of sqlxprs executed with a statement from the cache of db 
+// after binding params to its SQL parameters. The texts of column textcol are kept
+template<typename Accumulator>
+int ReadBatches(sqlite3* db, std::string sqlxprs, const std::vector<double> &params,
+                Accumulator accumulate, int textcol = -1)
+{
+  int rc = SQLITE_OK;
+  sqlite3_stmt *stmt = GetCachedStmt(db, sqlxprs, &rc);
+  if (rc != SQLITE_OK)
+    return rc;
+
+  ColumnReader reader(stmt, textcol);
+  rc = reader.Bind(params);
+  if (rc != SQLITE_OK)
+    return rc;
+  return ReadBatches(reader, accumulate);
+}
+
+
+/* Get the smallest and largest rowid of tblname. Sets empty if the table has no rows.
+Returns an error code for views and WITHOUT ROWID tables.
+*/
+int RowidRange(sqlite3* db, std::string tblname, sqlite3_int64 *minrowid, 
+  sqlite3_int64 *maxrowid, bool *empty);
+
+// SQL of a worker in ParallelReadBatches scanning the rowids from lower to upper
+std::string RowidRangeSql(std::string selectxprs, std::string whereclause, 
+  sqlite3_int64 lower, sqlite3_int64 upper);
+
+/* Scan the rows of selectxprs, a "SELECT ... FROM tblname" statement without a WHERE 
+clause, satisfying the optional whereclause with params bound to its SQL parameters with nthreads 
+worker threads that each read a separate rowid range of tblname through their own read-only
+connection. Each worker passes its batches of rows to accumulate(ithread, batch) so the
+caller can bin them into private per-thread bins without locking.
+Returns SQLITE_OK on success. If the table cannot be scanned in parallel, as is the case
+for in-memory databases, views or WITHOUT ROWID tables, nothing is accumulated and an 
+error code is returned so the caller can fall back to a serial scan. This is also the case
+inside an open transaction of db and for tables of the temp or an attached database, which
+the worker connections would not see as db does.
+All workers read the same snapshot which is the last committed state of the database file
+when the scan starts. In WAL mode this may include commits made after the statement calling
+ParallelReadBatches started reading, which a serial scan would not see.
+*/
+int ParallelReadBatches(sqlite3* db, std::string tblname, std::string selectxprs, 
+  std::string whereclause, const std::vector<double> &params, int nthreads,
+  std::function<void(int, const columnset &)> accumulate, int textcol = -1);
+
+
+/* How a random sample of rows was drawn which determines how bin counts of the sample
+are scaled up to estimated bin counts of all rows.
+*/
+struct samplestats
+{
+  bool bernoulli;    // each row was sampled independently with probability fraction
+  double fraction;
+  double nsampled;   // or else a simple random sample of nsampled rows (or rowids) 
+  double population; // was drawn from a population of this many rows (or rowids)
+  std::string sqlxprs; // the SQL that read the sampled rows
+  samplestats()
+  {
+    bernoulli = false;
+    fraction = 1.0;
+    nsampled = population = 0.0;
+  }
+};
+
+/* Draw a random sample of the rows of selectxprs, a "SELECT ... FROM tblname" statement 
+without a WHERE clause, satisfying the optional whereclause with params bound to its SQL 
+parameters, and pass the sampled rows in batches to accumulate(batch). 
+If 0 < sample < 1 it is the fraction of rows in a Bernoulli sample. If sample >= 1 it is 
+the number of rows in a simple random sample. Small samples of rowid tables are drawn by 
+looking up random rowids so unsampled pages of the table are never read. Otherwise the
+table is scanned and the sample is drawn from the scanned rows with reservoir sampling.
+*/
+int SampleReadBatches(sqlite3* db, std::string tblname, std::string selectxprs, 
+  std::string whereclause, const std::vector<double> &params, double sample,
+  samplestats *stats, std::function<void(const columnset &)> accumulate, int textcol = -1);
+
+/* The estimated count of rows in a bin of all rows from the count in the bin of a sample, 
+and the bounds of its 95% confidence interval.
+*/
+void EstimateCount(const samplestats &stats, sqlite3_int64 count, 
+  double *estcount, double *cilower, double *ciupper);
+
+
+/* Opt-in columnar cache of columns that are binned over and over. The values of a cached
+column are kept as packed blocks of doubles in the shadow table histocache_blocks and read 
+back in whole blocks instead of scanning the rows of the table. See columncache.cpp.
+*/
+// Cache colid of tblname or bring its cache up to date and return the number of rows cached
+int CacheColumn(sqlite3 *db, std::string tblname, std::string colid, sqlite3_int64 *nrows);
+int DropCachedColumn(sqlite3 *db, std::string tblname, std::string colid);
+// True if all colids of tblname are cached and up to date with the table. Nothing is written to
+// the database. The number of rows that can be read from all of them is returned in nrows
+bool ColumnCacheReady(sqlite3 *db, std::string tblname, const std::vector<std::string> &colids,
+  sqlite3_int64 *nrows);
+// Pass the first nrows cached rows of colids in batches of several cache blocks to accumulate(batch)
+int CachedReadBatches(sqlite3 *db, std::string tblname, const std::vector<std::string> &colids,
+  sqlite3_int64 nrows, std::function<void(const columnset &)> accumulate);
+// Description of a read from the column cache for the scanplan column
+std::string ColumnCachePlan(std::string tblname, const std::vector<std::string> &colids);
+
+
+/* The histogram functions work on bins number of bins in storage owned by the caller such as
+the vector of a cursor that is reused by every query on it. 
+CheckBins returns SQLITE_ERROR for nonsensical values of bins, minbin or maxbin.
+Histograms with bins of variable width pass their binedges as edges in which case bins, 
+minbin and maxbin must equal its number of bins, first and last edge.
+*/
+int CheckBins(int bins, double minbin, double maxbin);
+
+void InitHistogram(histobin *histo, int bins, double minbin, double maxbin,
+  const binedges *edges = NULL);
+void AccumHistogram(histobin *histo, int bins, columnview y, double minbin, double maxbin,
+  const binedges *edges = NULL);
+void AccumRatioHistogram(histobin *histo1, histobin *histo2, int bins, columnview y,
+  columnview discr, double discrval, double minbin, double maxbin, const binedges *edges = NULL);
+void MergeHistogram(histobin *histo, const histobin *partial, int bins);
+void FinalizeHistogram(histobin *histo, int bins);
+// Add the values of y to histograms of plain int counters at a different offset for each row
+void AccumGroupedCounts(int *counts, int bins, const sqlite3_int64 *offsets, columnview y,
+  double minbin, double maxbin, const binedges *edges = NULL);
+/* Add the non-NULL values of y to the bin counts and the weights of those rows with a 
+non-NULL weight in w to the sums of weights of their bins
+*/
+void AccumWeightedHistogram(histobin *histo, weightedbin *weights, int bins, columnview y,
+  columnview w, double minbin, double maxbin, const binedges *edges = NULL);
+void MergeWeights(weightedbin *weights, const weightedbin *partial, int bins);
+
+void InitInterpolations(interpolatebin *interpol, int bins, double minbin, double maxbin,
+  const binedges *edges = NULL);
+void AccumInterpolations(interpolatebin *interpol, int bins, columnview x, columnview y,
+  double minbin, double maxbin, const binedges *edges = NULL);
+void MergeInterpolations(interpolatebin *interpol, const interpolatebin *partial, int bins);
+void FinalizeInterpolations(interpolatebin *interpol, int bins);
+
+
+/* Grids of more cells than this keep the counts of the non-empty cells in a hash table rather
+than an array of counts for every cell
+*/
+const sqlite3_int64 MAXDENSECELLS = 1 << 20;
+
+/* Counts of x,y values in the cells of a grid of xbins by ybins bins. Cell ix*ybins + iy 
+holds the rows with x in bin ix and y in bin iy. Small grids are counted in the dense array
+counts. Large grids, which are mostly empty for the usual scatter data, are counted in the 
+hash table sparse and the non-empty cells are sorted into cells when the grid is finalized.
+*/
+struct grid2d
+{
+  int xbins, ybins;
+  double xmin, xmax, ymin, ymax;
+  bool dense;
+  std::vector<int> counts;
+  std::unordered_map<sqlite3_int64, int> sparse;
+  std::vector< std::pair<sqlite3_int64, int> > cells;
+};
+
+void InitGrid(grid2d &grid, int xbins, double xmin, double xmax, int ybins, double ymin,
+  double ymax);
+void AccumGrid(grid2d &grid, columnview x, columnview y);
+void MergeGrid(grid2d &grid, const grid2d &partial);
+void FinalizeGrid(grid2d &grid);
+// Number of output rows of a grid, every cell of a dense grid and the non-empty ones otherwise
+sqlite3_int64 GridRows(const grid2d &grid);
+// Bin centres and count of output row r of a finalized grid
+void GridRow(const grid2d &grid, sqlite3_int64 r, double *xval, double *yval, int *count);
+
+
+/* Counts of the non-empty bins of a histogram of so many bins that most of them stay empty. 
+The bin indices and their counts are kept in an open addressing hash table with linear 
+probing so memory grows with the number of occupied bins rather than the number of bins.
+*/
+class sparsebins
+{
+public:
+  sparsebins() : nused(0), shift(64) {}
+  void Clear();
+  void Add(int bin, int count = 1);
+  void Merge(const sparsebins &other);
+  // The occupied bins and their counts in ascending order of bin index
+  void Sorted(std::vector< std::pair<int, int> > &bins) const;
+  size_t size() const { return nused; }
+private:
+  void Grow();
+  size_t Slot(int bin) const
+  { // Fibonacci hashing spreads consecutive bin indices over the slots
+    return (size_t)(((sqlite3_uint64)(unsigned)bin * 0x9E3779B97F4A7C15ull) >> shift);
+  }
+  std::vector<int> keys; // bin index of each slot or -1 if the slot is empty
+  std::vector<int> counts;
+  size_t nused;
+  int shift; // 64 minus log2 of the number of slots
+};
+
+// Add the non-NULL values of y inside the bins to the counts of their bins in sparse
+void AccumSparseHistogram(sparsebins &sparse, int bins, columnview y, double minbin,
+  double maxbin, const binedges *edges = NULL);
+/* Append the occupied bins of sparse in ascending order to histo with their middle values
+and accumulated counts
+*/
+void FinalizeSparseHistogram(const sparsebins &sparse, std::vector<histobin> &histo, int bins,
+  double minbin, double maxbin, const binedges *edges = NULL);
+
+
+/* Significant decimal digits of the buckets of an HDR histogram */
+const int MINHDRDIGITS = 1;
+const int MAXHDRDIGITS = 5;
+
+// A bucket of an HDR histogram with the share of all values up to its upper bound in percent
+struct hdrbucket
+{
+  double lower, upper;
+  sqlite3_int64 count, accumcount;
+  double percentile;
+};
+
+/* Log-linear buckets of an HDR histogram which have the same relative width for values of any 
+magnitude. Each power of two is split into 2^subbits buckets of equal width where subbits is 
+the fewest bits for a relative width below 10^-digits. The bucket of a positive value is read 
+from the exponent and the leading subbits mantissa bits of its double so no logarithm is taken.
+The counts are kept in an array that only spans the buckets from the smallest to the largest 
+value seen. Zero has a bucket of its own. Negative, infinite and NaN values are not counted.
+*/
+class hdrbuckets
+{
+public:
+  hdrbuckets() { Reset(3); }
+  void Reset(int digits);
+  void Add(double val);
+  // Add the non-NULL values of a batch of rows
+  void Accum(columnview y);
+  void Merge(const hdrbuckets &other);
+  sqlite3_int64 total() const { return ntotal; }
+  // The occupied buckets in ascending order
+  void Finalize(std::vector<hdrbucket> &buckets) const;
+  /* Estimate of the value at percentile p between 0 and 100 which is the middle of the bucket
+  holding that rank or NAN if there are no values
+  */
+  double Percentile(double p) const;
+private:
+  void Span(sqlite3_int64 minkey, sqlite3_int64 maxkey);
+  int subbits, shift;
+  sqlite3_int64 zeros, ntotal;
+  sqlite3_int64 firstkey; // bucket of counts[0]
+  std::vector<sqlite3_int64> counts;
+};
+
+
+/* Value of a group column. NULL values form a group of their own, numbers are grouped by
+value whether they are stored as INTEGER or REAL and TEXT and BLOB values by their bytes.
+*/
+struct groupkey
+{
+  int type; // SQLITE_NULL, SQLITE_INTEGER, SQLITE_FLOAT or SQLITE_TEXT
+  double num;
+  std::string text;
+  groupkey(int t = SQLITE_NULL, double n = 0.0, std::string s = "") : type(t), num(n), text(s) {}
+  bool operator==(const groupkey &other) const;
+  // Order of SQLite: NULL before numbers before texts
+  bool operator<(const groupkey &other) const;
+};
+
+struct groupkeyhash
+{
+  size_t operator()(const groupkey &key) const;
+};
+
+/* Bin counters of the histograms of ncols columns for every distinct value of a group 
+column that are filled in a single scan. The counters are plain ints in one array with a block
+of ncols*bins counters for each group in the order the groups are first seen so the counters
+of many groups are packed densely and those of a row are next to each other.
+*/
+class grouphistograms
+{
+public:
+  void Reset(int ncols, int bins, double minbin, double maxbin, const binedges *edges = NULL);
+  // Add a batch where the columns 0 to ncols-1 are binned and column groupcol is grouped on
+  void Accum(const columnset &batch, int groupcol);
+  // Add the counts of the groups of other to the same groups here
+  void Merge(const grouphistograms &other);
+  /* The group values in keys in ascending order and their histograms in histo with the 
+  ncols histograms of each group following one another
+  */
+  void Finalize(std::vector<groupkey> &keys, std::vector<histobin> &histo) const;
+  size_t ngroups() const { return keys.size(); }
+private:
+  int Group(const groupkey &key);
+  int ncols, bins;
+  double minbin, maxbin;
+  const binedges *edges;
+  std::vector<groupkey> keys;
+  std::unordered_map<groupkey, int, groupkeyhash> groupindex;
+  std::vector<int> counts;
+  std::vector<sqlite3_int64> offsets; // offset of the counters of each row of a batch
+  std::vector<int> textgroups; // group of each text of the group column of a batch
+};
+
+
+/* Rules for the number of bins given as 'fd', 'scott' or 'sturges' in place of nbins. 
+Freedman-Diaconis and Scott choose a bin width from the interquartile range and the standard
+deviation of the values, Sturges log2(n) + 1 bins for n values. At most MAXRULEBINS bins.
+*/
+enum BinRules
+{
+  BINRULE_NONE = 0,
+  BINRULE_FD = 1,
+  BINRULE_SCOTT = 2,
+  BINRULE_STURGES = 3
+};
+const int MAXRULEBINS = 100000;
+
+// The rule named by val or BINRULE_NONE if val is not the name of a rule
+int ParseBinRule(sqlite3_value *val);
+
+
+/* Batches of rows held in memory while a table is scanned for a histogram without a given
+minbin or maxbin or with a rule for nbins. The rows are binned by replaying the batches once
+the range and number of bins is known so the table is read only once. Each scan thread 
+appends to its own list of batches.
+*/
+class rowbuffer
+{
+public:
+  void Reset(int nthreads);
+  // Keep a copy of a batch read by thread ithread, or by the only reader if ithread is -1
+  void Append(int ithread, const columnset &batch);
+  /* Find the range of the values of the columns 0 to ncols-1 for the bins of the scale of
+  power and set those of minbin and maxbin that are to be found. maxbin is just above the 
+  largest value so it falls in the last bin. Only positive values count for the log scale
+  and negative powers.
+  */
+  void FitRange(int ncols, double power, bool findmin, bool findmax, double *minbin,
+    double *maxbin) const;
+  // Number of bins by rule of the values of columns 0 to ncols-1 between minbin and maxbin
+  int RuleBins(int rule, int ncols, double minbin, double maxbin, double power) const;
+  void Replay(std::function<void(const columnset &)> accumulate) const;
+  void Clear() { batches.clear(); }
+private:
+  std::vector< std::vector<columnset> > batches;
+};
+
 
-std::vector<histobin> CalcHistogram(std::vector< std::vector<double> > Yvals,
-  int bins, double minbin, double maxbin, int *rc);
+int CalcHistogram(columnview y, histobin *histo, int bins, double minbin, double maxbin);
 
-std::vector<interpolatebin> CalcInterpolations(std::vector< std::vector<double> > XYvals, 
-  int bins, double minbin, double maxbin, int *rc);
+int CalcInterpolations(columnview x, columnview y, interpolatebin *interpol, int bins,
+  double minbin, double maxbin);
 
 
 
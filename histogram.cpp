@@ -28,6 +28,7 @@ SOFTWARE.
 #include <iostream>
 #include <vector>
 #include <cstdlib>
+#include <algorithm>
 
 #include "RegistExt.h"
 #include "helpers.h"
@@ -61,10 +62,33 @@ struct histo_cursor {
   sqlite3_int64  totalcount;
   std::string    tblname;
   std::string    colid;
+  std::vector<std::string> colids; // the names in the comma separated list colid
   int            nbins;
   double         minbin;
   double         maxbin;
-  std::vector<histobin> histogram;
+  binedges       edges; // bins of variable width if nbins was given as a list of edges
+  double         binpower; // scale of the bins, 1 for linear and 0 for logarithmic
+  const binedges *varedges; // edges if the bins are of variable width or else NULL
+  rowbuffer      rows; // rows read before the range or number of bins is known
+  std::string    whereclause;
+  double         sample;
+  std::string    groupcolid;
+  samplestats    stats;
+  std::string    scansql;
+  std::string    scanplan;
+  int            scanthreads;
+  std::vector<histobin> histogram; // nbins bins for each of colids one after the other
+  std::vector<histobin> partial; // private histograms of the scan threads
+  grouphistograms groups; // counts of each group if grouping on groupcolid
+  std::vector<grouphistograms> partialgroups;
+  std::vector<groupkey> groupkeys; // the groups in the order of the histograms
+  bool           sparse; // only count and output the occupied bins
+  std::vector<sparsebins> sparsehisto; // occupied bins of each of colids if sparse
+  std::vector<sparsebins> partialsparse;
+  std::vector<size_t> colrows; // first output row of the histogram of each column if sparse
+  std::string    weightcolid;
+  std::vector<weightedbin> weights; // sums of weights of the bins of histogram if weighted
+  std::vector<weightedbin> partialweights;
 };
 
 
@@ -80,7 +104,21 @@ enum ColNum
   HISTO_COLID,     
   HISTO_NBINS,     
   HISTO_MINBIN,    
-  HISTO_MAXBIN    
+  HISTO_MAXBIN,
+  HISTO_WHERE,
+  HISTO_SAMPLE,
+  HISTO_GROUPCOL,
+  HISTO_BINSCALE,
+  HISTO_SPARSE,
+  HISTO_WEIGHTCOL,
+  HISTO_SCANPLAN,    /* output only hidden columns follow the argument columns */
+  HISTO_ESTCOUNT,
+  HISTO_CILOWER,
+  HISTO_CIUPPER,
+  HISTO_COLNAME,
+  HISTO_GROUP,
+  HISTO_SUMW,
+  HISTO_SUMW2
 };
 
 
@@ -108,7 +146,7 @@ int histoConnect(
   char **pzErr
 )
 {
-  sqlite3_vtab *pNew;
+  histo_vtab *pNew;
   int rc;
   // The hidden columns serves as arguments to the HISTO function as in:
   // SELECT * FROM HISTO('tblname', 'colid', nbins, minbin, maxbin, 'discrcolid', discrval);
@@ -116,12 +154,17 @@ int histoConnect(
   rc = sqlite3_declare_vtab(db,
     // Order of columns MUST match the order of the above enum ColNum
     "CREATE TABLE x(bin REAL, bincount INTEGER, accumcount INTEGER, " \
-  "tblname hidden, colid hidden, nbins hidden, minbin hidden, maxbin hidden)");
+  "tblname hidden, colid hidden, nbins hidden, minbin hidden, maxbin hidden, " \
+  "whereclause hidden, sample hidden, groupcolid hidden, binscale hidden, sparse hidden, weightcolid hidden, scanplan hidden, estcount hidden, " \
+  "cilower hidden, ciupper hidden, colname hidden, grp hidden, sumw hidden, sumw2 hidden)");
   if( rc==SQLITE_OK )
   {
-    pNew = *ppVtab = (sqlite3_vtab *)sqlite3_malloc( sizeof(*pNew) );
+    pNew = (histo_vtab *)sqlite3_malloc( sizeof(*pNew) );
     if( pNew==0 ) return SQLITE_NOMEM;
     memset(pNew, 0, sizeof(*pNew));
+    pNew->db = db;
+    *ppVtab = &pNew->base;
+    AcquireStmtCache(db);
   }
   thisdb = db;
   return rc;
@@ -131,6 +174,7 @@ int histoConnect(
 ** This method is the destructor for histo_cursor objects.
 */
 int histoDisconnect(sqlite3_vtab *pVtab){
+  ReleaseStmtCache(((histo_vtab *)pVtab)->db);
   sqlite3_free(pVtab);
   return SQLITE_OK;
 }
@@ -186,11 +230,75 @@ int histoColumn(
     case HISTO_BIN:     d = pCur->bin; sqlite3_result_double(ctx, d); break;
     case HISTO_COUNT1:  x = pCur->count1; sqlite3_result_int64(ctx, x); break;
     case HISTO_COUNT2:  x = pCur->count2; sqlite3_result_int64(ctx, x); break;
-    case HISTO_TBLNAME: c = pCur->tblname; sqlite3_result_text(ctx, c.c_str(), -1, NULL);  break;
-    case HISTO_COLID:   c = pCur->colid; sqlite3_result_text(ctx, c.c_str(), -1, NULL); break;
+    case HISTO_TBLNAME: c = pCur->tblname; sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT);  break;
+    case HISTO_COLID:   c = pCur->colid; sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT); break;
     case HISTO_NBINS:   x = pCur->nbins; sqlite3_result_double(ctx, x); break;
     case HISTO_MINBIN:  d = pCur->minbin; sqlite3_result_double(ctx, d); break;
     case HISTO_MAXBIN:  d = pCur->maxbin; sqlite3_result_double(ctx, d); break;
+    case HISTO_WHERE:  c = pCur->whereclause; sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT); break;
+    case HISTO_SAMPLE:  d = pCur->sample; sqlite3_result_double(ctx, d); break;
+    case HISTO_GROUPCOL: c = pCur->groupcolid; sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT); break;
+    case HISTO_BINSCALE: c = BinScaleName(pCur->binpower); sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT); break;
+    case HISTO_SPARSE:  x = pCur->sparse; sqlite3_result_int64(ctx, x); break;
+    case HISTO_WEIGHTCOL: c = pCur->weightcolid; sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT); break;
+    case HISTO_SCANPLAN: {
+      if (pCur->scanplan == "") // only look up the query plan if it is asked for
+        pCur->scanplan = QueryPlan(thisdb, pCur->scansql);
+      if (pCur->scanthreads > 1)
+        c = std::to_string(pCur->scanthreads) + " THREADS: " + pCur->scanplan;
+      else
+        c = pCur->scanplan;
+      sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT);
+    } break;
+    case HISTO_ESTCOUNT:
+    case HISTO_CILOWER:
+    case HISTO_CIUPPER: {
+      if (pCur->sample <= 0.0)
+      { // counts are exact if not sampling rows
+        sqlite3_result_null(ctx);
+        break;
+      }
+      double estcount, cilower, ciupper;
+      EstimateCount(pCur->stats, pCur->count1, &estcount, &cilower, &ciupper);
+      d = i == HISTO_ESTCOUNT ? estcount : (i == HISTO_CILOWER ? cilower : ciupper);
+      sqlite3_result_double(ctx, d);
+    } break;
+    case HISTO_COLNAME: { // the column binned in the current row
+      unsigned k = (pCur->iRowid - 1) / pCur->nbins % pCur->colids.size();
+      if (pCur->sparse) // the histograms of the columns have as many rows as occupied bins
+        k = std::upper_bound(pCur->colrows.begin(), pCur->colrows.end(), 
+          (size_t)(pCur->iRowid - 1)) - pCur->colrows.begin() - 1;
+      c = pCur->colids[k];
+      sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT);
+    } break;
+    case HISTO_GROUP: { // the value of the group column of the histogram in the current row
+      unsigned g = (pCur->iRowid - 1) / (pCur->nbins * pCur->colids.size());
+      if (pCur->groupcolid == "" || g >= pCur->groupkeys.size())
+      {
+        sqlite3_result_null(ctx);
+        break;
+      }
+      const groupkey &key = pCur->groupkeys[g];
+      if (key.type == SQLITE_INTEGER)
+        sqlite3_result_int64(ctx, (sqlite3_int64)key.num);
+      else if (key.type == SQLITE_FLOAT)
+        sqlite3_result_double(ctx, key.num);
+      else if (key.type == SQLITE_TEXT)
+        sqlite3_result_text(ctx, key.text.c_str(), key.text.size(), SQLITE_TRANSIENT);
+      else
+        sqlite3_result_null(ctx);
+    } break;
+    case HISTO_SUMW:
+    case HISTO_SUMW2: { // sums of the weights of the bin if weighted
+      if (pCur->weights.empty())
+      {
+        sqlite3_result_null(ctx);
+        break;
+      }
+      const weightedbin &w = pCur->weights[pCur->iRowid - 1];
+      d = i == HISTO_SUMW ? w.sumw : w.sumw2;
+      sqlite3_result_double(ctx, d);
+    } break;
     default:            x = pCur->count1; sqlite3_result_int64(ctx, x); break;
   }
   return SQLITE_OK;
@@ -222,6 +330,53 @@ int histoEof(sqlite3_vtab_cursor *cur) {
 }
 
 
+/* Set up the empty histograms of every column and of the groups once the bins are known.
+Bins of a log or power scale are set up as bins of variable width between their edges.
+*/
+static int InitBins(histo_cursor *pCur, bool isedges, std::string *errmsg)
+{
+  int rc = SQLITE_OK;
+  pCur->varedges = NULL;
+  if (!isedges && pCur->binpower != 1.0)
+  {
+    rc = CheckBins(pCur->nbins, pCur->minbin, pCur->maxbin);
+    if (rc != SQLITE_OK)
+      return rc;
+    rc = ScaledBinEdges(pCur->edges, pCur->nbins, pCur->minbin, pCur->maxbin, pCur->binpower,
+      errmsg);
+    if (rc != SQLITE_OK)
+      return rc;
+    isedges = true;
+  }
+  if (isedges)
+  {
+    pCur->varedges = &pCur->edges;
+    pCur->nbins = pCur->edges.bins();
+    pCur->minbin = pCur->edges.edges.front();
+    pCur->maxbin = pCur->edges.edges.back();
+  }
+  rc = CheckBins(pCur->nbins, pCur->minbin, pCur->maxbin);
+  if (rc != SQLITE_OK)
+    return rc;
+  int ncols = pCur->colids.size();
+  int nbins = pCur->nbins;
+  if (pCur->sparse)
+  { // no memory for the empty bins
+    pCur->histogram.clear();
+    pCur->sparsehisto.assign(ncols, sparsebins());
+    return SQLITE_OK;
+  }
+  pCur->histogram.resize(ncols * nbins);
+  if (pCur->weightcolid != "")
+    pCur->weights.assign(ncols * nbins, weightedbin());
+  for (int k = 0; k < ncols; k++)
+    InitHistogram(pCur->histogram.data() + k * nbins, nbins, pCur->minbin, pCur->maxbin,
+      pCur->varedges);
+  pCur->groups.Reset(ncols, nbins, pCur->minbin, pCur->maxbin, pCur->varedges);
+  return SQLITE_OK;
+}
+
+
 /*
 ** This method is called to "rewind" the histo_cursor object back
 ** to the first row of output.  This method is always called at least
@@ -247,43 +402,329 @@ int histoFilter(
   pCur->nbins = 1.0;
   pCur->minbin = 1.0;
   pCur->maxbin = 1.0;
+  pCur->whereclause = "";
+  pCur->sample = 0.0;
+  pCur->groupcolid = "";
+  pCur->edges.edges.clear();
+  pCur->binpower = 1.0;
+  pCur->sparse = false;
+  pCur->weightcolid = "";
+  pCur->weights.clear();
+  std::vector<double> edges;
+  bool isedges = false;
+  int binrule = BINRULE_NONE;
+  bool findmin = false, findmax = false;
+  std::string errmsg;
   
-  if( idxNum >= HISTO_MAXBIN)
+  if( RequiredArgs(idxNum) >= HISTO_MAXBIN)
   {
     pCur->tblname = (const char*)sqlite3_value_text(argv[i++]);
-    pCur->colid = (const char*)sqlite3_value_text(argv[i++]);
-    pCur->nbins = sqlite3_value_double(argv[i++]);
+    if (idxNum & ARG_COLIN)
+      rc = JoinInList(argv[i++], &pCur->colid, &errmsg);
+    else
+      pCur->colid = (const char*)sqlite3_value_text(argv[i++]);
+    isedges = IsBinEdges(argv[i]);
+    binrule = isedges ? BINRULE_NONE : ParseBinRule(argv[i]);
+    if (isedges && rc == SQLITE_OK)
+      rc = ParseBinEdges(argv[i], &edges, &errmsg);
+    else if (binrule == BINRULE_NONE)
+      pCur->nbins = sqlite3_value_double(argv[i]);
+    i++;
+    findmin = !isedges && sqlite3_value_type(argv[i]) == SQLITE_NULL;
     pCur->minbin = sqlite3_value_double(argv[i++]);
+    findmax = !isedges && sqlite3_value_type(argv[i]) == SQLITE_NULL;
     pCur->maxbin = sqlite3_value_double(argv[i++]);
+    if (idxNum & ARG_WHERE && sqlite3_value_type(argv[i]) != SQLITE_NULL)
+      pCur->whereclause = (const char*)sqlite3_value_text(argv[i]);
+    if (idxNum & ARG_WHERE)
+      i++;
+    if (idxNum & ARG_SAMPLE)
+      pCur->sample = sqlite3_value_double(argv[i++]);
+    if (idxNum & ARG_GROUP && sqlite3_value_type(argv[i]) != SQLITE_NULL)
+      pCur->groupcolid = (const char*)sqlite3_value_text(argv[i]);
+    if (idxNum & ARG_GROUP)
+      i++;
+    if (idxNum & ARG_BINSCALE && rc == SQLITE_OK)
+      rc = ParseBinScale(argv[i], &pCur->binpower, &errmsg);
+    if (idxNum & ARG_BINSCALE)
+      i++;
+    if (idxNum & ARG_SPARSE)
+      pCur->sparse = sqlite3_value_int(argv[i++]) != 0;
+    if (idxNum & ARG_WEIGHT && sqlite3_value_type(argv[i]) != SQLITE_NULL)
+      pCur->weightcolid = (const char*)sqlite3_value_text(argv[i]);
+    if (idxNum & ARG_WEIGHT)
+      i++;
   }
   else 
   {
     const char *zText = "Incorrect arguments for function HISTO which must be called as:\n" \
-      " HISTO('tablename', 'columnname', nbins, minbin, maxbin)\n";
+      " HISTO('tablename', 'columnname', nbins, minbin, maxbin [, 'whereclause', sample, 'groupcolid', binscale, sparse, 'weightcolid'])\n" \
+      " or with a list of bin edges as HISTO('tablename', 'columnname', '[edge0, edge1, ...]', NULL, NULL)\n" \
+      " where nbins may be 'fd', 'scott' or 'sturges' and minbin or maxbin NULL to find them from the values\n";
     pCur->base.pVtab->zErrMsg = sqlite3_mprintf( zText);
 
     return SQLITE_ERROR;
   }
 
-  std::vector< std::vector<double> > mybins;
-  std::string s_exe("SELECT ");
-  s_exe += pCur->colid + " FROM " + pCur->tblname;
-  mybins.clear();
-	mybins = GetColumns(thisdb, s_exe, &rc);
-	if (rc != SQLITE_OK)
-	{
+  /* Bins of variable width are given as a list of edges in place of nbins. The first and 
+  last edge then replace minbin and maxbin which are ignored.
+  */
+  if (rc == SQLITE_OK && isedges)
+    rc = SetBinEdges(pCur->edges, edges, &errmsg);
+  if (rc == SQLITE_OK && isedges && pCur->binpower != 1.0)
+  {
+    errmsg = "binscale cannot be used with a list of bin edges";
+    rc = SQLITE_ERROR;
+  }
+  if (rc == SQLITE_OK && pCur->sparse && pCur->groupcolid != "")
+  {
+    errmsg = "sparse histograms cannot be grouped on groupcolid";
+    rc = SQLITE_ERROR;
+  }
+  if (rc == SQLITE_OK && pCur->weightcolid != "" && (pCur->sparse || pCur->groupcolid != ""))
+  {
+    errmsg = "weighted histograms cannot be sparse or grouped on groupcolid";
+    rc = SQLITE_ERROR;
+  }
+  if (rc != SQLITE_OK)
+  {
+    pCur->base.pVtab->zErrMsg = sqlite3_mprintf("%s", errmsg.c_str());
+    return rc;
+  }
+
+  /* Several columns separated by commas are binned in one scan of the table into 
+  histograms that follow one another in the output
+  */
+  pCur->colids = SplitColumnList(pCur->colid);
+  for (unsigned k = 0; k < pCur->colids.size() && rc == SQLITE_OK; k++)
+  {
+    if (pCur->colids[k] == "")
+    {
+      errmsg = "missing column name in the list of columns: " + pCur->colid;
+      rc = SQLITE_ERROR;
+    }
+  }
+  /* With a group column each row is binned into the histograms of the group of its value
+  in the group column which is read after the binned columns
+  */
+  bool grouped = pCur->groupcolid != "";
+  std::vector<std::string> colids = pCur->colids;
+  if (grouped)
+    colids.push_back(pCur->groupcolid);
+  // the weight of each row is read after the binned columns
+  bool weighted = pCur->weightcolid != "";
+  if (weighted)
+    colids.push_back(pCur->weightcolid);
+  if (rc == SQLITE_OK)
+    rc = CheckColumns(thisdb, pCur->tblname, colids, &errmsg);
+  if (rc != SQLITE_OK)
+  {
+    pCur->base.pVtab->zErrMsg = sqlite3_mprintf("%s", errmsg.c_str());
+    return rc;
+  }
+  int ncols = pCur->colids.size();
+  /* Without minbin or maxbin or with a rule for nbins the rows are held in memory while
+  scanning the table and binned once the bins are known
+  */
+  bool autorange = findmin || findmax || binrule != BINRULE_NONE;
+  if (!autorange)
+  {
+    rc = InitBins(pCur, isedges, &errmsg);
+    if (rc != SQLITE_OK)
+    {
+      if (errmsg != "")
+        pCur->base.pVtab->zErrMsg = sqlite3_mprintf("%s", errmsg.c_str());
+      return rc;
+    }
+  }
+
+  std::string s_tbl = QuoteTableName(pCur->tblname);
+  std::vector<std::string> s_cols;
+  std::string s_columns;
+  for (int k = 0; k < ncols; k++)
+  {
+    s_cols.push_back(QuoteId(pCur->colids[k]));
+    s_columns += (k > 0 ? ", " : "") + s_cols[k];
+  }
+  if (grouped)
+    s_columns += ", " + QuoteId(pCur->groupcolid);
+  if (weighted)
+    s_columns += ", " + QuoteId(pCur->weightcolid);
+
+  // only scan rows with values inside the histogram range or of any value if it is to be found
+  std::string s_where = BinRangeClause(s_cols, pCur->whereclause);
+  std::vector<double> params = { findmin ? -INFINITY : pCur->minbin, 
+    findmax ? INFINITY : pCur->maxbin };
+  pCur->scansql = SelectSql(s_columns, s_tbl, s_where);
+  pCur->scanplan = "";
+  pCur->scanthreads = 1;
+  auto accumulate = [pCur, ncols, grouped, weighted](int ithread, const columnset &batch)
+  { // bin each column of the batch into its own histogram of the scan thread or of the group
+    if (grouped)
+    {
+      (ithread < 0 ? pCur->groups : pCur->partialgroups[ithread]).Accum(batch, ncols);
+      return;
+    }
+    int nbins = pCur->nbins;
+    if (pCur->sparse)
+    {
+      sparsebins *sparse = pCur->sparsehisto.data();
+      if (ithread >= 0)
+        sparse = pCur->partialsparse.data() + ithread * ncols;
+      for (int k = 0; k < ncols; k++)
+        AccumSparseHistogram(sparse[k], nbins, columnview(batch, k), pCur->minbin, pCur->maxbin,
+          pCur->varedges);
+      return;
+    }
+    histobin *histo = pCur->histogram.data();
+    if (ithread >= 0)
+      histo = pCur->partial.data() + ithread * pCur->histogram.size();
+    if (weighted)
+    {
+      weightedbin *weights = pCur->weights.data();
+      if (ithread >= 0)
+        weights = pCur->partialweights.data() + ithread * pCur->weights.size();
+      for (int k = 0; k < ncols; k++)
+        AccumWeightedHistogram(histo + k * nbins, weights + k * nbins, nbins, columnview(batch, k),
+          columnview(batch, ncols), pCur->minbin, pCur->maxbin, pCur->varedges);
+      return;
+    }
+    for (int k = 0; k < ncols; k++)
+      AccumHistogram(histo + k * nbins, nbins, columnview(batch, k), pCur->minbin, pCur->maxbin,
+        pCur->varedges);
+  };
+  std::function<void(int, const columnset &)> scan = accumulate;
+  if (autorange)
+  {
+    pCur->rows.Reset(histoconfig.scanthreads);
+    scan = [pCur](int ithread, const columnset &batch) { pCur->rows.Append(ithread, batch); };
+  }
+  rc = SQLITE_MISUSE;
+  bool cached = false;
+  sqlite3_int64 ncached = 0;
+  // only the texts of the group column are needed, and kept
+  int textcol = grouped ? ncols : -1;
+  if (pCur->sample > 0.0)
+  { // bin a random sample of the rows
+    rc = SampleReadBatches(thisdb, s_tbl, SelectSql(s_columns, s_tbl, ""),
+      s_where, params, pCur->sample, &pCur->stats, [&](const columnset &batch)
+    {
+      scan(-1, batch);
+    }, textcol);
+    pCur->scansql = pCur->stats.sqlxprs;
+  }
+  else if (pCur->whereclause == "" && !grouped 
+    && ColumnCacheReady(thisdb, pCur->tblname, colids, &ncached))
+  { // read the values from the blocks of the columnar cache which holds no text for grouping
+    cached = true;
+    rc = CachedReadBatches(thisdb, pCur->tblname, colids, ncached, [&](const columnset &batch)
+    {
+      scan(-1, batch);
+    });
+    pCur->scanplan = ColumnCachePlan(pCur->tblname, colids);
+  }
+  else if (histoconfig.scanthreads > 1)
+  { // each worker thread bins its rowid range into private histograms or keeps its rows
+    size_t nhisto = pCur->histogram.size();
+    if (grouped && !autorange)
+      pCur->partialgroups.assign(histoconfig.scanthreads, pCur->groups);
+    else if (pCur->sparse && !autorange)
+      pCur->partialsparse.assign(histoconfig.scanthreads * ncols, sparsebins());
+    else if (!autorange)
+      pCur->partial.assign(histoconfig.scanthreads * nhisto, histobin());
+    if (weighted && !autorange)
+      pCur->partialweights.assign(histoconfig.scanthreads * nhisto, weightedbin());
+    std::string s_select = SelectSql(s_columns, s_tbl, "");
+    rc = ParallelReadBatches(thisdb, s_tbl, s_select, s_where, params,
+      histoconfig.scanthreads, scan, textcol);
+    if (rc == SQLITE_OK)
+    {
+      for (int t = 0; t < histoconfig.scanthreads && !autorange; t++)
+      {
+        if (grouped)
+          pCur->groups.Merge(pCur->partialgroups[t]);
+        else if (pCur->sparse)
+        {
+          for (int k = 0; k < ncols; k++)
+            pCur->sparsehisto[k].Merge(pCur->partialsparse[t * ncols + k]);
+        }
+        else
+          MergeHistogram(pCur->histogram.data(), pCur->partial.data() + t * nhisto, nhisto);
+        if (weighted)
+          MergeWeights(pCur->weights.data(), pCur->partialweights.data() + t * nhisto, nhisto);
+      }
+      pCur->scansql = RowidRangeSql(s_select, s_where, 0, 0);
+      pCur->scanthreads = histoconfig.scanthreads;
+    }
+    pCur->partialgroups.clear();
+    pCur->partialsparse.clear();
+    pCur->partialweights.clear();
+  }
+  if (rc != SQLITE_OK && pCur->sample <= 0.0 && !cached)
+  { // stream the column values into the bins batch by batch
+    if (autorange)
+      pCur->rows.Reset(1); // drop any rows of a failed parallel scan
+    rc = ReadBatches(thisdb, pCur->scansql, params, [&](const columnset &batch)
+    {
+      scan(-1, batch);
+    }, textcol);
+  }
+  if (rc != SQLITE_OK)
+  {
+    pCur->rows.Clear();
     pCur->base.pVtab->zErrMsg = sqlite3_mprintf(sqlite3_errmsg(thisdb));
-		return rc;
-	}
-  pCur->histogram = CalcHistogram(mybins, pCur->nbins, pCur->minbin, pCur->maxbin, &rc);
-	if (rc != SQLITE_OK)
-		return rc;
+    return rc;
+  }
+  if (autorange)
+  { // the bins follow from the values of the rows which are then binned
+    pCur->rows.FitRange(ncols, pCur->binpower, findmin, findmax, &pCur->minbin, &pCur->maxbin);
+    if (binrule != BINRULE_NONE)
+      pCur->nbins = pCur->rows.RuleBins(binrule, ncols, pCur->minbin, pCur->maxbin, pCur->binpower);
+    rc = InitBins(pCur, false, &errmsg);
+    if (rc == SQLITE_OK)
+    {
+      pCur->rows.Replay([&](const columnset &batch)
+      {
+        accumulate(-1, batch);
+      });
+    }
+    pCur->rows.Clear();
+    if (rc != SQLITE_OK)
+    {
+      if (errmsg != "")
+        pCur->base.pVtab->zErrMsg = sqlite3_mprintf("%s", errmsg.c_str());
+      return rc;
+    }
+  }
+  int nbins = pCur->nbins;
+  if (grouped)
+  {
+    pCur->groups.Finalize(pCur->groupkeys, pCur->histogram);
+  }
+  else if (pCur->sparse)
+  { // the histograms of the columns follow one another with only their occupied bins
+    pCur->colrows.clear();
+    for (int k = 0; k < ncols; k++)
+    {
+      pCur->colrows.push_back(pCur->histogram.size());
+      FinalizeSparseHistogram(pCur->sparsehisto[k], pCur->histogram, nbins, pCur->minbin,
+        pCur->maxbin, pCur->varedges);
+    }
+    pCur->sparsehisto.clear();
+  }
+  else
+  {
+    for (int k = 0; k < ncols; k++)
+      FinalizeHistogram(pCur->histogram.data() + k * nbins, nbins);
+  }
 
+	pCur->iRowid = 1;
+	pCur->isDesc = 0;
+  if (pCur->histogram.empty()) // no groups
+    return rc;
 	pCur->bin = pCur->histogram[0].binval;
 	pCur->count1 = pCur->histogram[0].count;
 	pCur->count2 = pCur->histogram[0].accumcount;
-	pCur->isDesc = 0;
-	pCur->iRowid = 1;
 
   return rc;
 }
@@ -316,6 +757,12 @@ int histoBestIndex(
   int binsidx = -1;      /* Index of the step= constraint, or -1 if none */
   int minbinidx = -1;
   int maxbinidx = -1;
+  int whereidx = -1;
+  int sampleidx = -1;
+  int groupidx = -1;
+  int binscaleidx = -1;
+  int sparseidx = -1;
+  int weightidx = -1;
   int nArg = 0;          /* Number of arguments that histoFilter() expects */
 
   sqlite3_index_info::sqlite3_index_constraint *pConstraint;
@@ -344,6 +791,24 @@ int histoBestIndex(
         maxbinidx = i;
         idxNum = HISTO_MAXBIN;
         break;
+      case HISTO_WHERE:
+        whereidx = i;
+        break;
+      case HISTO_SAMPLE:
+        sampleidx = i;
+        break;
+      case HISTO_GROUPCOL:
+        groupidx = i;
+        break;
+      case HISTO_BINSCALE:
+        binscaleidx = i;
+        break;
+      case HISTO_SPARSE:
+        sparseidx = i;
+        break;
+      case HISTO_WEIGHTCOL:
+        weightidx = i;
+        break;
     }
   }
   if(tblnameidx >=0 ){
@@ -353,6 +818,9 @@ int histoBestIndex(
   if(colididx >=0 ){
     pIdxInfo->aConstraintUsage[colididx].argvIndex = ++nArg;
     pIdxInfo->aConstraintUsage[colididx].omit = 1;
+    // bin all the columns of colid IN (...) in one scan rather than scanning once per column
+    if (HasVtabIn() && sqlite3_vtab_in(pIdxInfo, colididx, 1))
+      idxNum |= ARG_COLIN;
   }
   if (binsidx >= 0) {
     pIdxInfo->aConstraintUsage[binsidx].argvIndex = ++nArg;
@@ -366,12 +834,39 @@ int histoBestIndex(
     pIdxInfo->aConstraintUsage[maxbinidx].argvIndex = ++nArg;
     pIdxInfo->aConstraintUsage[maxbinidx].omit = 1;
   }
+  if (whereidx >= 0) { // optional arguments follow the required ones
+    pIdxInfo->aConstraintUsage[whereidx].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[whereidx].omit = 1;
+    idxNum |= ARG_WHERE;
+  }
+  if (sampleidx >= 0) {
+    pIdxInfo->aConstraintUsage[sampleidx].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[sampleidx].omit = 1;
+    idxNum |= ARG_SAMPLE;
+  }
+  if (groupidx >= 0) {
+    pIdxInfo->aConstraintUsage[groupidx].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[groupidx].omit = 1;
+    idxNum |= ARG_GROUP;
+  }
+  if (binscaleidx >= 0) {
+    pIdxInfo->aConstraintUsage[binscaleidx].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[binscaleidx].omit = 1;
+    idxNum |= ARG_BINSCALE;
+  }
+  if (sparseidx >= 0) {
+    pIdxInfo->aConstraintUsage[sparseidx].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[sparseidx].omit = 1;
+    idxNum |= ARG_SPARSE;
+  }
+  if (weightidx >= 0) {
+    pIdxInfo->aConstraintUsage[weightidx].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[weightidx].omit = 1;
+    idxNum |= ARG_WEIGHT;
+  }
   pIdxInfo->estimatedCost = 2.0;
   pIdxInfo->estimatedRows = 500;
-  if( pIdxInfo->nOrderBy==1 )
-  {
-    pIdxInfo->orderByConsumed = 1;
-  }
+  // ORDER BY is left to SQLite as the histograms of several columns are not ordered by bin
   pIdxInfo->idxNum = idxNum;
   return SQLITE_OK;
 }
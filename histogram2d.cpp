@@ -0,0 +1,464 @@
+/*
+histogram2d.cpp
+
+SQLite extension for calculating two dimensional histograms of the x,y values of two columns
+for heatmaps of scatter data.
+
+The MIT License (MIT)
+
+Copyright (c) 2017 Robert Oeffner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+
+#include "RegistExt.h"
+#include "helpers.h"
+#include <assert.h>
+#include <memory.h>
+
+
+#ifndef SQLITE_OMIT_VIRTUALTABLE
+
+
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+
+/* histo2d_cursor is a subclass of sqlite3_vtab_cursor which will
+** serve as the underlying representation of a cursor that scans
+** over rows of the result
+*/
+typedef struct histo2d_cursor histo2d_cursor;
+struct histo2d_cursor {
+  sqlite3_vtab_cursor base;  /* Base class - must be first */
+  sqlite3_int64 iRowid;      /* The rowid */
+  double         x;
+  double         y;
+  int            count;
+  std::string    tblname;
+  std::string    xcolid;
+  std::string    ycolid;
+  int            xnbins;
+  double         xminbin;
+  double         xmaxbin;
+  int            ynbins;
+  double         yminbin;
+  double         ymaxbin;
+  std::string    whereclause;
+  double         sample;
+  samplestats    stats;
+  std::string    scansql;
+  std::string    scanplan;
+  int            scanthreads;
+  grid2d         grid;
+  std::vector<grid2d> partial; // private grids of the scan threads
+};
+
+
+
+enum ColNum
+{ /* Column numbers. The order determines the order of columns in the table output
+  and must match the order of columns in the CREATE TABLE statement below
+  */
+  HISTO2D_X = 0,
+  HISTO2D_Y,
+  HISTO2D_COUNT,
+  HISTO2D_TBLNAME,
+  HISTO2D_XCOLID,
+  HISTO2D_YCOLID,
+  HISTO2D_XNBINS,
+  HISTO2D_XMINBIN,
+  HISTO2D_XMAXBIN,
+  HISTO2D_YNBINS,
+  HISTO2D_YMINBIN,
+  HISTO2D_YMAXBIN,
+  HISTO2D_WHERE,
+  HISTO2D_SAMPLE,
+  HISTO2D_SCANPLAN,    /* output only hidden columns follow the argument columns */
+  HISTO2D_ESTCOUNT,
+  HISTO2D_CILOWER,
+  HISTO2D_CIUPPER
+};
+
+
+int histo2dConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+)
+{
+  histo_vtab *pNew;
+  int rc;
+/* The hidden columns serves as arguments to the HISTO2D function as in:
+SELECT * FROM HISTO2D('tblname', 'xcolid', 'ycolid', xnbins, xminbin, xmaxbin, ynbins, yminbin, ymaxbin);
+They won't show up in the SQL tables.
+*/
+  rc = sqlite3_declare_vtab(db,
+// Order of columns MUST match the order of the above enum ColNum
+  "CREATE TABLE x(xbin REAL, ybin REAL, bincount INTEGER, " \
+  "tblname hidden, xcolid hidden, ycolid hidden, xnbins hidden, xminbin hidden, xmaxbin hidden, " \
+  "ynbins hidden, yminbin hidden, ymaxbin hidden, " \
+  "whereclause hidden, sample hidden, scanplan hidden, estcount hidden, cilower hidden, ciupper hidden)");
+  if( rc==SQLITE_OK )
+  {
+    pNew = (histo_vtab *)sqlite3_malloc( sizeof(*pNew) );
+    if( pNew==0 ) return SQLITE_NOMEM;
+    memset(pNew, 0, sizeof(*pNew));
+    pNew->db = db;
+    *ppVtab = &pNew->base;
+    AcquireStmtCache(db);
+  }
+  thisdb = db;
+  return rc;
+}
+
+/*
+** This method is the destructor for histo2d_cursor objects.
+*/
+int histo2dDisconnect(sqlite3_vtab *pVtab){
+  ReleaseStmtCache(((histo_vtab *)pVtab)->db);
+  sqlite3_free(pVtab);
+  return SQLITE_OK;
+}
+
+/*
+** Constructor for a new histo2d_cursor object.
+*/
+int histo2dOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **ppCursor){
+  histo2d_cursor *pCur;
+  // allocate c++ object with new rather than sqlite3_malloc which doesn't call constructors
+  pCur = new histo2d_cursor;
+  if (pCur == NULL) return SQLITE_NOMEM;
+  *ppCursor = &pCur->base;
+  return SQLITE_OK;
+}
+
+/*
+** Destructor for a histo2d_cursor.
+*/
+int histo2dClose(sqlite3_vtab_cursor *cur){
+  delete cur;
+  return SQLITE_OK;
+}
+
+
+/*
+** Advance a histo2d_cursor to its next row of output.
+*/
+int histo2dNext(sqlite3_vtab_cursor *cur){
+  histo2d_cursor *pCur = (histo2d_cursor*)cur;
+  pCur->iRowid++;
+  if (pCur->iRowid <= GridRows(pCur->grid))
+    GridRow(pCur->grid, pCur->iRowid - 1, &pCur->x, &pCur->y, &pCur->count);
+  return SQLITE_OK;
+}
+
+/*
+** Return values of columns for the row at which the histo2d_cursor
+** is currently pointing.
+*/
+int histo2dColumn(
+  sqlite3_vtab_cursor *cur,   /* The cursor */
+  sqlite3_context *ctx,       /* First argument to sqlite3_result_...() */
+  int i                       /* Which column to return */
+){
+  histo2d_cursor *pCur = (histo2d_cursor*)cur;
+  sqlite3_int64 x = 123456;
+  std::string c = "waffle";
+  double d = -42.24;
+  switch( i ){
+    case HISTO2D_X:       d = pCur->x; sqlite3_result_double(ctx, d); break;
+    case HISTO2D_Y:       d = pCur->y; sqlite3_result_double(ctx, d); break;
+    case HISTO2D_COUNT:   x = pCur->count; sqlite3_result_int64(ctx, x); break;
+    case HISTO2D_TBLNAME: c = pCur->tblname; sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT);  break;
+    case HISTO2D_XCOLID:  c = pCur->xcolid; sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT); break;
+    case HISTO2D_YCOLID:  c = pCur->ycolid; sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT); break;
+    case HISTO2D_XNBINS:  x = pCur->xnbins; sqlite3_result_double(ctx, x); break;
+    case HISTO2D_XMINBIN: d = pCur->xminbin; sqlite3_result_double(ctx, d); break;
+    case HISTO2D_XMAXBIN: d = pCur->xmaxbin; sqlite3_result_double(ctx, d); break;
+    case HISTO2D_YNBINS:  x = pCur->ynbins; sqlite3_result_double(ctx, x); break;
+    case HISTO2D_YMINBIN: d = pCur->yminbin; sqlite3_result_double(ctx, d); break;
+    case HISTO2D_YMAXBIN: d = pCur->ymaxbin; sqlite3_result_double(ctx, d); break;
+    case HISTO2D_WHERE:   c = pCur->whereclause; sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT); break;
+    case HISTO2D_SAMPLE:  d = pCur->sample; sqlite3_result_double(ctx, d); break;
+    case HISTO2D_SCANPLAN: {
+      if (pCur->scanplan == "") // only look up the query plan if it is asked for
+        pCur->scanplan = QueryPlan(thisdb, pCur->scansql);
+      if (pCur->scanthreads > 1)
+        c = std::to_string(pCur->scanthreads) + " THREADS: " + pCur->scanplan;
+      else
+        c = pCur->scanplan;
+      sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT);
+    } break;
+    case HISTO2D_ESTCOUNT:
+    case HISTO2D_CILOWER:
+    case HISTO2D_CIUPPER: {
+      if (pCur->sample <= 0.0)
+      { // counts are exact if not sampling rows
+        sqlite3_result_null(ctx);
+        break;
+      }
+      double estcount, cilower, ciupper;
+      EstimateCount(pCur->stats, pCur->count, &estcount, &cilower, &ciupper);
+      d = i == HISTO2D_ESTCOUNT ? estcount : (i == HISTO2D_CILOWER ? cilower : ciupper);
+      sqlite3_result_double(ctx, d);
+    } break;
+    default:           sqlite3_result_double(ctx, 0); break;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Return the rowid for the current row.  In this implementation, the
+** rowid is the same as the output value.
+*/
+int histo2dRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid){
+  histo2d_cursor *pCur = (histo2d_cursor*)cur;
+  *pRowid = pCur->iRowid;
+  return SQLITE_OK;
+}
+
+/*
+** Return TRUE if the cursor has been moved off of the last
+** row of output.
+*/
+int histo2dEof(sqlite3_vtab_cursor *cur) {
+  histo2d_cursor *pCur = (histo2d_cursor*)cur;
+  return pCur->iRowid > GridRows(pCur->grid);
+}
+
+
+
+int histo2dFilter(
+  sqlite3_vtab_cursor *pVtabCursor, 
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+){
+  histo2d_cursor *pCur = (histo2d_cursor *)pVtabCursor;
+  int i = 0, rc = SQLITE_OK;
+  pCur->tblname = "";
+  pCur->xcolid = "";
+  pCur->ycolid = "";
+  pCur->xnbins = pCur->ynbins = 1;
+  pCur->xminbin = pCur->yminbin = 1.0;
+  pCur->xmaxbin = pCur->ymaxbin = 1.0;
+  pCur->whereclause = "";
+  pCur->sample = 0.0;
+
+  if( RequiredArgs(idxNum) >= HISTO2D_YMAXBIN)
+  {
+    pCur->tblname = (const char*)sqlite3_value_text(argv[i++]);
+    pCur->xcolid = (const char*)sqlite3_value_text(argv[i++]);
+    pCur->ycolid = (const char*)sqlite3_value_text(argv[i++]);
+    pCur->xnbins = sqlite3_value_double(argv[i++]);
+    pCur->xminbin = sqlite3_value_double(argv[i++]);
+    pCur->xmaxbin = sqlite3_value_double(argv[i++]);
+    pCur->ynbins = sqlite3_value_double(argv[i++]);
+    pCur->yminbin = sqlite3_value_double(argv[i++]);
+    pCur->ymaxbin = sqlite3_value_double(argv[i++]);
+    if (idxNum & ARG_WHERE && sqlite3_value_type(argv[i]) != SQLITE_NULL)
+      pCur->whereclause = (const char*)sqlite3_value_text(argv[i]);
+    if (idxNum & ARG_WHERE)
+      i++;
+    if (idxNum & ARG_SAMPLE)
+      pCur->sample = sqlite3_value_double(argv[i++]);
+  }
+  else 
+  {
+    const char *zText = "Incorrect arguments for function HISTO2D which must be called as:\n" \
+     " HISTO2D('tablename', 'xcolumnname', 'ycolumnname', xnbins, xminbin, xmaxbin, ynbins, yminbin, ymaxbin" \
+     " [, 'whereclause', sample])\n";
+    pCur->base.pVtab->zErrMsg = sqlite3_mprintf(zText);
+    return SQLITE_ERROR;
+  }
+  
+  rc = CheckBins(pCur->xnbins, pCur->xminbin, pCur->xmaxbin);
+  if (rc == SQLITE_OK)
+    rc = CheckBins(pCur->ynbins, pCur->yminbin, pCur->ymaxbin);
+  if (rc != SQLITE_OK)
+    return rc;
+  InitGrid(pCur->grid, pCur->xnbins, pCur->xminbin, pCur->xmaxbin, pCur->ynbins,
+    pCur->yminbin, pCur->ymaxbin);
+
+  std::string errmsg;
+  rc = CheckColumns(thisdb, pCur->tblname, { pCur->xcolid, pCur->ycolid }, &errmsg);
+  if (rc != SQLITE_OK)
+  {
+    pCur->base.pVtab->zErrMsg = sqlite3_mprintf("%s", errmsg.c_str());
+    return rc;
+  }
+  std::string s_tbl = QuoteTableName(pCur->tblname);
+  std::string s_x = QuoteId(pCur->xcolid);
+  std::string s_y = QuoteId(pCur->ycolid);
+  std::string s_columns = s_x + ", " + s_y;
+
+  // only scan rows with both x and y values inside the grid
+  std::string s_where = s_x + " >= ?1 AND " + s_x + " < ?2 AND " + s_y + " >= ?3 AND " + s_y + " < ?4";
+  if (pCur->whereclause != "")
+    s_where += " AND (" + pCur->whereclause + ")";
+  std::vector<double> params = { pCur->xminbin, pCur->xmaxbin, pCur->yminbin, pCur->ymaxbin };
+  pCur->scansql = SelectSql(s_columns, s_tbl, s_where);
+  pCur->scanplan = "";
+  pCur->scanthreads = 1;
+  auto accumulate = [pCur](const columnset &batch)
+  {
+    AccumGrid(pCur->grid, columnview(batch, 0), columnview(batch, 1));
+  };
+  std::vector<std::string> colids = { pCur->xcolid, pCur->ycolid };
+  rc = SQLITE_MISUSE;
+  bool cached = false;
+  sqlite3_int64 ncached = 0;
+  if (pCur->sample > 0.0)
+  { // bin a random sample of the rows
+    rc = SampleReadBatches(thisdb, s_tbl, SelectSql(s_columns, s_tbl, ""),
+      s_where, params, pCur->sample, &pCur->stats, accumulate);
+    pCur->scansql = pCur->stats.sqlxprs;
+  }
+  else if (pCur->whereclause == "" && ColumnCacheReady(thisdb, pCur->tblname, colids, &ncached))
+  { // read the x,y values from the blocks of the columnar cache
+    cached = true;
+    rc = CachedReadBatches(thisdb, pCur->tblname, colids, ncached, accumulate);
+    pCur->scanplan = ColumnCachePlan(pCur->tblname, colids);
+  }
+  else if (histoconfig.scanthreads > 1)
+  { // each worker thread bins its rowid range into a private grid
+    pCur->partial.assign(histoconfig.scanthreads, pCur->grid);
+    std::string s_select = SelectSql(s_columns, s_tbl, "");
+    rc = ParallelReadBatches(thisdb, s_tbl, s_select, s_where, params,
+      histoconfig.scanthreads, [pCur](int ithread, const columnset &batch)
+    {
+      AccumGrid(pCur->partial[ithread], columnview(batch, 0), columnview(batch, 1));
+    });
+    if (rc == SQLITE_OK)
+    {
+      for (unsigned t = 0; t < pCur->partial.size(); t++)
+        MergeGrid(pCur->grid, pCur->partial[t]);
+      pCur->scansql = RowidRangeSql(s_select, s_where, 0, 0);
+      pCur->scanthreads = histoconfig.scanthreads;
+    }
+    pCur->partial.clear();
+  }
+  if (rc != SQLITE_OK && pCur->sample <= 0.0 && !cached)
+  { // stream the x,y values into the grid batch by batch
+    rc = ReadBatches(thisdb, pCur->scansql, params, accumulate);
+  }
+  if (rc != SQLITE_OK)
+  {
+    pCur->base.pVtab->zErrMsg = sqlite3_mprintf(sqlite3_errmsg(thisdb));
+    return rc;
+  }
+  FinalizeGrid(pCur->grid);
+
+  pCur->iRowid = 0;
+  return histo2dNext(pVtabCursor);
+}
+
+
+int histo2dBestIndex(
+  sqlite3_vtab *tab,
+  sqlite3_index_info *pIdxInfo
+){
+  int idxNum = 0;        /* The query plan bitmask */
+  int nArg = 0;          /* Number of arguments that histo2dFilter() expects */
+  int argidx[HISTO2D_SAMPLE + 1]; /* Index of the constraint of each argument column or -1 */
+  for (int c = 0; c <= HISTO2D_SAMPLE; c++)
+    argidx[c] = -1;
+
+  sqlite3_index_info::sqlite3_index_constraint *pConstraint;
+  pConstraint = pIdxInfo->aConstraint;
+  for(int i=0; i<pIdxInfo->nConstraint; i++, pConstraint++){
+    if( pConstraint->usable==0 ) continue;
+    if( pConstraint->op!=SQLITE_INDEX_CONSTRAINT_EQ ) continue;
+    if (pConstraint->iColumn >= HISTO2D_TBLNAME && pConstraint->iColumn <= HISTO2D_SAMPLE)
+      argidx[pConstraint->iColumn] = i;
+  }
+  // the required arguments must all be present and come first in the order of the columns
+  for (int c = HISTO2D_TBLNAME; c <= HISTO2D_YMAXBIN && argidx[c] >= 0; c++)
+  {
+    pIdxInfo->aConstraintUsage[argidx[c]].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[argidx[c]].omit = 1;
+    idxNum = c;
+  }
+  if (idxNum == HISTO2D_YMAXBIN && argidx[HISTO2D_WHERE] >= 0) { // optional arguments follow
+    pIdxInfo->aConstraintUsage[argidx[HISTO2D_WHERE]].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[argidx[HISTO2D_WHERE]].omit = 1;
+    idxNum |= ARG_WHERE;
+  }
+  if (RequiredArgs(idxNum) == HISTO2D_YMAXBIN && argidx[HISTO2D_SAMPLE] >= 0) {
+    pIdxInfo->aConstraintUsage[argidx[HISTO2D_SAMPLE]].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[argidx[HISTO2D_SAMPLE]].omit = 1;
+    idxNum |= ARG_SAMPLE;
+  }
+  pIdxInfo->estimatedCost = 2.0;
+  pIdxInfo->estimatedRows = 500;
+  pIdxInfo->idxNum = idxNum;
+  return SQLITE_OK;
+}
+
+
+
+
+/*
+** This following structure defines all the methods for the
+** generate_histo2d virtual table.
+*/
+sqlite3_module histo2dModule = {
+  0,                         /* iVersion */
+  0,                         /* xCreate */
+  histo2dConnect,             /* xConnect */
+  histo2dBestIndex,           /* xBestIndex */
+  histo2dDisconnect,          /* xDisconnect */
+  0,                         /* xDestroy */
+  histo2dOpen,                /* xOpen - open a cursor */
+  histo2dClose,               /* xClose - close a cursor */
+  histo2dFilter,              /* xFilter - configure scan constraints */
+  histo2dNext,                /* xNext - advance a cursor */
+  histo2dEof,                 /* xEof - check for end of scan */
+  histo2dColumn,              /* xColumn - read data */
+  histo2dRowid,               /* xRowid - read data */
+  0,                         /* xUpdate */
+  0,                         /* xBegin */
+  0,                         /* xSync */
+  0,                         /* xCommit */
+  0,                         /* xRollback */
+  0,                         /* xFindMethod */
+  0,                         /* xRename */
+};
+
+
+
+#endif /* SQLITE_OMIT_VIRTUALTABLE */
+
+
+
+
+#ifdef __cplusplus
+}
+#endif
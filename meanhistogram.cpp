@@ -69,6 +69,15 @@ struct meanhisto_cursor {
   int            nbins;
   double         minbin;
   double         maxbin;
+  std::string    whereclause;
+  double         sample;
+  double         binpower; // scale of the bins, 1 for linear and 0 for logarithmic
+  binedges       edges; // edges of the bins of a log or power scale
+  const binedges *varedges; // &edges for a log or power scale or else NULL
+  rowbuffer      rows; // rows read before the range or number of bins is known
+  samplestats    stats;
+  std::string    scansql;
+  std::string    scanplan;
   std::vector<interpolatebin> meanhistobins;
 };
 
@@ -88,7 +97,14 @@ enum ColNum
   MEANHISTO_YCOLID,
   MEANHISTO_NBINS,
   MEANHISTO_MINBIN,    
-  MEANHISTO_MAXBIN    
+  MEANHISTO_MAXBIN,
+  MEANHISTO_WHERE,
+  MEANHISTO_SAMPLE,
+  MEANHISTO_BINSCALE,
+  MEANHISTO_SCANPLAN,    /* output only hidden columns follow the argument columns */
+  MEANHISTO_ESTCOUNT,
+  MEANHISTO_CILOWER,
+  MEANHISTO_CIUPPER
 };
 
 
@@ -100,7 +116,7 @@ int meanhistoConnect(
   char **pzErr
 )
 {
-  sqlite3_vtab *pNew;
+  histo_vtab *pNew;
   int rc;
 /* The hidden columns serves as arguments to the MEANHISTO function as in:
 SELECT * FROM MEANHISTO('tblname', 'xcolid', 'ycolid', nbins, minbin, maxbin);
@@ -109,12 +125,16 @@ They won't show up in the SQL tables.
   rc = sqlite3_declare_vtab(db,
 // Order of columns MUST match the order of the above enum ColNum
   "CREATE TABLE x(xbin REAL, yval REAL, sigma REAL, sem REAL, bincount INTEGER, " \
-  "tblname hidden, xcolid hidden, ycolid hidden, nbins hidden, minbin hidden, maxbin hidden)");
+  "tblname hidden, xcolid hidden, ycolid hidden, nbins hidden, minbin hidden, maxbin hidden, " \
+  "whereclause hidden, sample hidden, binscale hidden, scanplan hidden, estcount hidden, cilower hidden, ciupper hidden)");
   if( rc==SQLITE_OK )
   {
-    pNew = *ppVtab = (sqlite3_vtab *)sqlite3_malloc( sizeof(*pNew) );
+    pNew = (histo_vtab *)sqlite3_malloc( sizeof(*pNew) );
     if( pNew==0 ) return SQLITE_NOMEM;
     memset(pNew, 0, sizeof(*pNew));
+    pNew->db = db;
+    *ppVtab = &pNew->base;
+    AcquireStmtCache(db);
   }
   thisdb = db;
   return rc;
@@ -124,6 +144,7 @@ They won't show up in the SQL tables.
 ** This method is the destructor for meanhisto_cursor objects.
 */
 int meanhistoDisconnect(sqlite3_vtab *pVtab){
+  ReleaseStmtCache(((histo_vtab *)pVtab)->db);
   sqlite3_free(pVtab);
   return SQLITE_OK;
 }
@@ -189,6 +210,27 @@ int meanhistoColumn(
     case MEANHISTO_NBINS:    x = pCur->nbins; sqlite3_result_double(ctx, x); break;
     case MEANHISTO_MINBIN:  d = pCur->minbin; sqlite3_result_double(ctx, d); break;
     case MEANHISTO_MAXBIN:  d = pCur->maxbin; sqlite3_result_double(ctx, d); break;
+    case MEANHISTO_WHERE:  c = pCur->whereclause; sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT); break;
+    case MEANHISTO_SAMPLE:  d = pCur->sample; sqlite3_result_double(ctx, d); break;
+    case MEANHISTO_BINSCALE: c = BinScaleName(pCur->binpower); sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT); break;
+    case MEANHISTO_SCANPLAN: {
+      if (pCur->scanplan == "") // only look up the query plan if it is asked for
+        pCur->scanplan = QueryPlan(thisdb, pCur->scansql);
+      sqlite3_result_text(ctx, pCur->scanplan.c_str(), -1, SQLITE_TRANSIENT);
+    } break;
+    case MEANHISTO_ESTCOUNT:
+    case MEANHISTO_CILOWER:
+    case MEANHISTO_CIUPPER: {
+      if (pCur->sample <= 0.0)
+      { // counts are exact if not sampling rows
+        sqlite3_result_null(ctx);
+        break;
+      }
+      double estcount, cilower, ciupper;
+      EstimateCount(pCur->stats, pCur->count, &estcount, &cilower, &ciupper);
+      d = i == MEANHISTO_ESTCOUNT ? estcount : (i == MEANHISTO_CILOWER ? cilower : ciupper);
+      sqlite3_result_double(ctx, d);
+    } break;
     default:           sqlite3_result_double(ctx, 0); break;
   }
   return SQLITE_OK;
@@ -221,6 +263,30 @@ int meanhistoEof(sqlite3_vtab_cursor *cur) {
 
 
 
+/* Set up the empty interpolation bins once the bins are known. Bins of a log or power scale
+are set up as bins of variable width between their edges.
+*/
+static int InitBins(meanhisto_cursor *pCur, std::string *errmsg)
+{
+  int rc = CheckBins(pCur->nbins, pCur->minbin, pCur->maxbin);
+  if (rc != SQLITE_OK)
+    return rc;
+  pCur->varedges = NULL;
+  if (pCur->binpower != 1.0)
+  {
+    rc = ScaledBinEdges(pCur->edges, pCur->nbins, pCur->minbin, pCur->maxbin, pCur->binpower,
+      errmsg);
+    if (rc != SQLITE_OK)
+      return rc;
+    pCur->varedges = &pCur->edges;
+  }
+  pCur->meanhistobins.resize(pCur->nbins);
+  InitInterpolations(pCur->meanhistobins.data(), pCur->nbins, pCur->minbin, pCur->maxbin,
+    pCur->varedges);
+  return SQLITE_OK;
+}
+
+
 int meanhistoFilter(
   sqlite3_vtab_cursor *pVtabCursor, 
   int idxNum, const char *idxStr,
@@ -234,35 +300,131 @@ int meanhistoFilter(
   pCur->nbins = 1.0;
   pCur->minbin = 1.0;
   pCur->maxbin = 1.0;
-
-  if( idxNum >= MEANHISTO_MAXBIN)
+  pCur->whereclause = "";
+  pCur->sample = 0.0;
+  pCur->binpower = 1.0;
+  int binrule = BINRULE_NONE;
+  bool findmin = false, findmax = false;
+  std::string errmsg;
+
+  if( RequiredArgs(idxNum) >= MEANHISTO_MAXBIN)
   {
     pCur->tblname = (const char*)sqlite3_value_text(argv[i++]);
     pCur->xcolid = (const char*)sqlite3_value_text(argv[i++]);
     pCur->ycolid = (const char*)sqlite3_value_text(argv[i++]);
-    pCur->nbins = sqlite3_value_double(argv[i++]);
+    binrule = ParseBinRule(argv[i]);
+    if (binrule == BINRULE_NONE)
+      pCur->nbins = sqlite3_value_double(argv[i]);
+    i++;
+    findmin = sqlite3_value_type(argv[i]) == SQLITE_NULL;
     pCur->minbin = sqlite3_value_double(argv[i++]);
+    findmax = sqlite3_value_type(argv[i]) == SQLITE_NULL;
     pCur->maxbin = sqlite3_value_double(argv[i++]);
+    if (idxNum & ARG_WHERE && sqlite3_value_type(argv[i]) != SQLITE_NULL)
+      pCur->whereclause = (const char*)sqlite3_value_text(argv[i]);
+    if (idxNum & ARG_WHERE)
+      i++;
+    if (idxNum & ARG_SAMPLE)
+      pCur->sample = sqlite3_value_double(argv[i++]);
+    if (idxNum & ARG_BINSCALE)
+      rc = ParseBinScale(argv[i++], &pCur->binpower, &errmsg);
   }
   else 
   {
     const char *zText = "Incorrect arguments for function MEANHISTO which must be called as:\n" \
-     " MEANHISTO('tablename', 'xcolumnname', 'ycolumnname', nbins, minbin, maxbin)\n";
+     " MEANHISTO('tablename', 'xcolumnname', 'ycolumnname', nbins, minbin, maxbin [, 'whereclause', sample, binscale])\n" \
+     " where nbins may be 'fd', 'scott' or 'sturges' and minbin or maxbin NULL to find them from the x values\n";
     pCur->base.pVtab->zErrMsg = sqlite3_mprintf(zText);
     return SQLITE_ERROR;
   }
   
-  std::string s_exe("SELECT ");
-  s_exe += pCur->xcolid + ", " + pCur->ycolid + " FROM " + pCur->tblname;
-  std::vector< std::vector<double> > myXYs = GetColumns(thisdb, s_exe, &rc);
-	if (rc != SQLITE_OK)
-	{
+  if (rc != SQLITE_OK)
+  {
+    pCur->base.pVtab->zErrMsg = sqlite3_mprintf("%s", errmsg.c_str());
+    return rc;
+  }
+  /* Without minbin or maxbin or with a rule for nbins the rows are held in memory while
+  scanning the table and binned once the bins are known
+  */
+  bool autorange = findmin || findmax || binrule != BINRULE_NONE;
+  if (!autorange)
+  {
+    rc = InitBins(pCur, &errmsg);
+    if (rc != SQLITE_OK)
+    {
+      if (errmsg != "")
+        pCur->base.pVtab->zErrMsg = sqlite3_mprintf("%s", errmsg.c_str());
+      return rc;
+    }
+  }
+
+  rc = CheckColumns(thisdb, pCur->tblname, { pCur->xcolid, pCur->ycolid }, &errmsg);
+  if (rc != SQLITE_OK)
+  {
+    pCur->base.pVtab->zErrMsg = sqlite3_mprintf("%s", errmsg.c_str());
+    return rc;
+  }
+  std::string s_tbl = QuoteTableName(pCur->tblname);
+  std::string s_columns = QuoteId(pCur->xcolid) + ", " + QuoteId(pCur->ycolid);
+  std::string s_where = BinRangeClause(QuoteId(pCur->xcolid), pCur->whereclause);
+
+  // stream the x,y values into the bins batch by batch
+  // only scan rows with x values inside the histogram range or of any value if it is to be found
+  std::vector<double> params = { findmin ? -INFINITY : pCur->minbin, 
+    findmax ? INFINITY : pCur->maxbin };
+  pCur->scansql = SelectSql(s_columns, s_tbl, s_where);
+  pCur->scanplan = "";
+  std::function<void(const columnset &)> accumulate = [pCur](const columnset &batch)
+  {
+    AccumInterpolations(pCur->meanhistobins.data(), pCur->nbins, columnview(batch, 0),
+      columnview(batch, 1), pCur->minbin, pCur->maxbin, pCur->varedges);
+  };
+  std::function<void(const columnset &)> scan = accumulate;
+  if (autorange)
+  {
+    pCur->rows.Reset(1);
+    scan = [pCur](const columnset &batch) { pCur->rows.Append(-1, batch); };
+  }
+  std::vector<std::string> colids = { pCur->xcolid, pCur->ycolid };
+  sqlite3_int64 ncached = 0;
+  if (pCur->sample > 0.0)
+  { // bin a random sample of the rows
+    rc = SampleReadBatches(thisdb, s_tbl, SelectSql(s_columns, s_tbl, ""),
+      s_where, params, pCur->sample, &pCur->stats, scan);
+    pCur->scansql = pCur->stats.sqlxprs;
+  }
+  else if (pCur->whereclause == "" && ColumnCacheReady(thisdb, pCur->tblname, colids, &ncached))
+  { // read the x,y values from the blocks of the columnar cache
+    rc = CachedReadBatches(thisdb, pCur->tblname, colids, ncached, scan);
+    pCur->scanplan = ColumnCachePlan(pCur->tblname, colids);
+  }
+  else
+  {
+    rc = ReadBatches(thisdb, pCur->scansql, params, scan);
+  }
+  if (rc != SQLITE_OK)
+  {
+    pCur->rows.Clear();
     pCur->base.pVtab->zErrMsg = sqlite3_mprintf(sqlite3_errmsg(thisdb));
-		return rc;
-	}
-  pCur->meanhistobins = CalcInterpolations(myXYs, pCur->nbins, pCur->minbin, pCur->maxbin, &rc);
-	if (rc != SQLITE_OK)
-		return rc;
+    return rc;
+  }
+  if (autorange)
+  { // the bins follow from the x values of the rows which are then binned
+    pCur->rows.FitRange(1, pCur->binpower, findmin, findmax, &pCur->minbin, &pCur->maxbin);
+    if (binrule != BINRULE_NONE)
+      pCur->nbins = pCur->rows.RuleBins(binrule, 1, pCur->minbin, pCur->maxbin, pCur->binpower);
+    rc = InitBins(pCur, &errmsg);
+    if (rc == SQLITE_OK)
+      pCur->rows.Replay(accumulate);
+    pCur->rows.Clear();
+    if (rc != SQLITE_OK)
+    {
+      if (errmsg != "")
+        pCur->base.pVtab->zErrMsg = sqlite3_mprintf("%s", errmsg.c_str());
+      return rc;
+    }
+  }
+  FinalizeInterpolations(pCur->meanhistobins.data(), pCur->nbins);
 
   pCur->x = pCur->meanhistobins[0].xval;
   pCur->y = pCur->meanhistobins[0].yval;
@@ -288,6 +450,9 @@ int meanhistoBestIndex(
   int binsidx = -1;      /* Index of the step= constraint, or -1 if none */
   int minbinidx = -1;
   int maxbinidx = -1;
+  int whereidx = -1;
+  int sampleidx = -1;
+  int binscaleidx = -1;
   int nArg = 0;          /* Number of arguments that meanhistoFilter() expects */
 
   sqlite3_index_info::sqlite3_index_constraint *pConstraint;
@@ -320,6 +485,15 @@ int meanhistoBestIndex(
         maxbinidx = i;
         idxNum = MEANHISTO_MAXBIN;
         break;
+      case MEANHISTO_WHERE:
+        whereidx = i;
+        break;
+      case MEANHISTO_SAMPLE:
+        sampleidx = i;
+        break;
+      case MEANHISTO_BINSCALE:
+        binscaleidx = i;
+        break;
     }
   }
   if(tblnameidx >=0 ){
@@ -346,6 +520,21 @@ int meanhistoBestIndex(
     pIdxInfo->aConstraintUsage[maxbinidx].argvIndex = ++nArg;
     pIdxInfo->aConstraintUsage[maxbinidx].omit = 1;
   }
+  if (whereidx >= 0) { // optional arguments follow the required ones
+    pIdxInfo->aConstraintUsage[whereidx].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[whereidx].omit = 1;
+    idxNum |= ARG_WHERE;
+  }
+  if (sampleidx >= 0) {
+    pIdxInfo->aConstraintUsage[sampleidx].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[sampleidx].omit = 1;
+    idxNum |= ARG_SAMPLE;
+  }
+  if (binscaleidx >= 0) {
+    pIdxInfo->aConstraintUsage[binscaleidx].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[binscaleidx].omit = 1;
+    idxNum |= ARG_BINSCALE;
+  }
   pIdxInfo->estimatedCost = 2.0;
   pIdxInfo->estimatedRows = 500;
   if( pIdxInfo->nOrderBy==1 )
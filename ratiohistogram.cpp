@@ -65,7 +65,14 @@ struct ratiohisto_cursor {
   double         minbin;
   double         maxbin;
   std::string    discrcolid;
-  std::string    discrval;
+  double         discrval;
+  std::string    whereclause;
+  double         sample;
+  double         binpower; // scale of the bins, 1 for linear and 0 for logarithmic
+  binedges       edges; // edges of the bins of a log or power scale
+  samplestats    stats;
+  std::string    scansql;
+  std::string    scanplan;
   std::vector<histobin> ratiohistogram1;
   std::vector<histobin> ratiohistogram2;
 };
@@ -87,7 +94,14 @@ enum ColNum
   RATIOHISTO_MINBIN,    
   RATIOHISTO_MAXBIN,    
   RATIOHISTO_DISCRCOLID,
-  RATIOHISTO_DISCRVAL  
+  RATIOHISTO_DISCRVAL,
+  RATIOHISTO_WHERE,
+  RATIOHISTO_SAMPLE,
+  RATIOHISTO_BINSCALE,
+  RATIOHISTO_SCANPLAN,    /* output only hidden columns follow the argument columns */
+  RATIOHISTO_ESTCOUNT,
+  RATIOHISTO_CILOWER,
+  RATIOHISTO_CIUPPER
 };
 
 
@@ -115,7 +129,7 @@ int ratiohistoConnect(
   char **pzErr
 )
 {
-  sqlite3_vtab *pNew;
+  histo_vtab *pNew;
   int rc;
   // The hidden columns serves as arguments to the RATIOHISTO function as in:
   // SELECT * FROM RATIOHISTO('tblname', 'colid', nbins, minbin, maxbin, 'discrcolid', discrval);
@@ -123,12 +137,16 @@ int ratiohistoConnect(
   rc = sqlite3_declare_vtab(db,
     // Order of columns MUST match the order of the above enum ColNum
     "CREATE TABLE x(bin REAL, count1 INTEGER, count2 INTEGER, ratio REAL, totalcount INTEGER, " \
-  "tblname hidden, colid hidden, nbins hidden, minbin hidden, maxbin hidden, discrcolid hidden, discrval hidden)");
+  "tblname hidden, colid hidden, nbins hidden, minbin hidden, maxbin hidden, discrcolid hidden, discrval hidden, " \
+  "whereclause hidden, sample hidden, binscale hidden, scanplan hidden, estcount hidden, cilower hidden, ciupper hidden)");
   if( rc==SQLITE_OK )
   {
-    pNew = *ppVtab = (sqlite3_vtab *)sqlite3_malloc( sizeof(*pNew) );
+    pNew = (histo_vtab *)sqlite3_malloc( sizeof(*pNew) );
     if( pNew==0 ) return SQLITE_NOMEM;
     memset(pNew, 0, sizeof(*pNew));
+    pNew->db = db;
+    *ppVtab = &pNew->base;
+    AcquireStmtCache(db);
   }
   thisdb = db;
   return rc;
@@ -138,6 +156,7 @@ int ratiohistoConnect(
 ** This method is the destructor for ratiohisto_cursor objects.
 */
 int ratiohistoDisconnect(sqlite3_vtab *pVtab){
+  ReleaseStmtCache(((histo_vtab *)pVtab)->db);
   sqlite3_free(pVtab);
   return SQLITE_OK;
 }
@@ -236,7 +255,28 @@ int ratiohistoColumn(
     case RATIOHISTO_MINBIN:  d = pCur->minbin; sqlite3_result_double(ctx, d); break;
     case RATIOHISTO_MAXBIN:  d = pCur->maxbin; sqlite3_result_double(ctx, d); break;
     case RATIOHISTO_DISCRCOLID:  c = pCur->discrcolid; sqlite3_result_text(ctx, c.c_str(), -1, NULL);  break;
-    case RATIOHISTO_DISCRVAL:  c = pCur->discrval; sqlite3_result_text(ctx, c.c_str(), -1, NULL);  break;
+    case RATIOHISTO_DISCRVAL:  d = pCur->discrval; sqlite3_result_double(ctx, d);  break;
+    case RATIOHISTO_WHERE:  c = pCur->whereclause; sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT); break;
+    case RATIOHISTO_SAMPLE:  d = pCur->sample; sqlite3_result_double(ctx, d); break;
+    case RATIOHISTO_BINSCALE: c = BinScaleName(pCur->binpower); sqlite3_result_text(ctx, c.c_str(), -1, SQLITE_TRANSIENT); break;
+    case RATIOHISTO_SCANPLAN: {
+      if (pCur->scanplan == "") // only look up the query plan if it is asked for
+        pCur->scanplan = QueryPlan(thisdb, pCur->scansql);
+      sqlite3_result_text(ctx, pCur->scanplan.c_str(), -1, SQLITE_TRANSIENT);
+    } break;
+    case RATIOHISTO_ESTCOUNT:
+    case RATIOHISTO_CILOWER:
+    case RATIOHISTO_CIUPPER: {
+      if (pCur->sample <= 0.0)
+      { // counts are exact if not sampling rows
+        sqlite3_result_null(ctx);
+        break;
+      }
+      double estcount, cilower, ciupper;
+      EstimateCount(pCur->stats, pCur->totalcount, &estcount, &cilower, &ciupper);
+      d = i == RATIOHISTO_ESTCOUNT ? estcount : (i == RATIOHISTO_CILOWER ? cilower : ciupper);
+      sqlite3_result_double(ctx, d);
+    } break;
     default:            x = pCur->count1; sqlite3_result_int64(ctx, x); break;
   }
   return SQLITE_OK;
@@ -294,73 +334,123 @@ int ratiohistoFilter(
   pCur->minbin = 1.0;
   pCur->maxbin = 1.0;
   pCur->discrcolid = "";
-  pCur->discrval = "0.0";
+  pCur->discrval = 0.0;
+  pCur->whereclause = "";
+  pCur->sample = 0.0;
+  pCur->binpower = 1.0;
+  std::string errmsg;
 
-  if (idxNum >= RATIOHISTO_DISCRVAL)
+  if (RequiredArgs(idxNum) >= RATIOHISTO_DISCRVAL)
   {
     pCur->tblname = (const char*)sqlite3_value_text(argv[i++]);
     pCur->colid = (const char*)sqlite3_value_text(argv[i++]);
     pCur->nbins = sqlite3_value_double(argv[i++]);
     pCur->minbin = sqlite3_value_double(argv[i++]);
     pCur->maxbin = sqlite3_value_double(argv[i++]);
-    pCur->discrcolid = (const char*)sqlite3_value_text(argv[i++]);
-    pCur->discrval = (const char*)sqlite3_value_text(argv[i++]);
+    if (sqlite3_value_type(argv[i]) != SQLITE_NULL)
+      pCur->discrcolid = (const char*)sqlite3_value_text(argv[i]);
+    i++;
+    pCur->discrval = sqlite3_value_double(argv[i++]);
+    if (idxNum & ARG_WHERE && sqlite3_value_type(argv[i]) != SQLITE_NULL)
+      pCur->whereclause = (const char*)sqlite3_value_text(argv[i]);
+    if (idxNum & ARG_WHERE)
+      i++;
+    if (idxNum & ARG_SAMPLE)
+      pCur->sample = sqlite3_value_double(argv[i++]);
+    if (idxNum & ARG_BINSCALE)
+      rc = ParseBinScale(argv[i++], &pCur->binpower, &errmsg);
   }
   else 
   {
     const char *zText = "Incorrect arguments for function RATIOHISTO which must be called as:\n" \
-      "RATIOHISTO('tablename', 'columnname', nbins, minbin, maxbin, 'discrcolid', discrval)\n";
+      "RATIOHISTO('tablename', 'columnname', nbins, minbin, maxbin, 'discrcolid', discrval [, 'whereclause', sample, binscale])\n";
     pCur->base.pVtab->zErrMsg = sqlite3_mprintf(zText);
     return SQLITE_ERROR;
   }
   
-  std::vector< std::vector<double> > mybins;
-  std::string s_exe("SELECT ");
-  s_exe += pCur->colid + " FROM " + pCur->tblname;
-  mybins.clear();
-	mybins = GetColumns(thisdb, s_exe, &rc);
-	if (rc != SQLITE_OK)
-	{
-    pCur->base.pVtab->zErrMsg = sqlite3_mprintf(sqlite3_errmsg(thisdb));
-		return rc;
-	}
-  pCur->ratiohistogram1 = CalcHistogram(mybins, pCur->nbins, pCur->minbin, pCur->maxbin, &rc);
-	if (rc != SQLITE_OK)
-		return rc;
+  if (rc != SQLITE_OK)
+  {
+    pCur->base.pVtab->zErrMsg = sqlite3_mprintf("%s", errmsg.c_str());
+    return rc;
+  }
+  rc = CheckBins(pCur->nbins, pCur->minbin, pCur->maxbin);
+  if (rc != SQLITE_OK)
+    return rc;
+  const binedges *varedges = NULL;
+  if (pCur->binpower != 1.0)
+  { // bins of a log or power scale are bins of variable width between their scaled edges
+    rc = ScaledBinEdges(pCur->edges, pCur->nbins, pCur->minbin, pCur->maxbin, pCur->binpower,
+      &errmsg);
+    if (rc != SQLITE_OK)
+    {
+      pCur->base.pVtab->zErrMsg = sqlite3_mprintf("%s", errmsg.c_str());
+      return rc;
+    }
+    varedges = &pCur->edges;
+  }
+  pCur->ratiohistogram1.resize(pCur->nbins);
   pCur->ratiohistogram2.resize(pCur->nbins);
-  pCur->totalcount = pCur->ratiohistogram1[0].count;
+  InitHistogram(pCur->ratiohistogram1.data(), pCur->nbins, pCur->minbin, pCur->maxbin, varedges);
+  InitHistogram(pCur->ratiohistogram2.data(), pCur->nbins, pCur->minbin, pCur->maxbin, varedges);
   pCur->ratio = 0.0;
 
-  if (pCur->discrcolid != "") // make two ratiohistograms for values above and below discrval
+  rc = CheckColumns(thisdb, pCur->tblname, { pCur->colid, pCur->discrcolid }, &errmsg);
+  if (rc != SQLITE_OK)
   {
-    std::string s_exe("SELECT "); // get first ratiohistogram where values are above discrval
-    s_exe += pCur->colid + " FROM " + pCur->tblname
-      + " WHERE " + pCur->discrcolid + " >= " + pCur->discrval;
-    mybins.clear();
-		mybins = GetColumns(thisdb, s_exe, &rc);
-		if (rc != SQLITE_OK)
-		{
-      pCur->base.pVtab->zErrMsg = sqlite3_mprintf(sqlite3_errmsg(thisdb));
-			return rc;
-		}
-    pCur->ratiohistogram1 = CalcHistogram(mybins, pCur->nbins, pCur->minbin, pCur->maxbin, &rc);
-		if (rc != SQLITE_OK)
-			return rc;
-
-    // get second ratiohistogram where values are below discrval
-    s_exe = "SELECT " + pCur->colid + " FROM " + pCur->tblname
-      + " WHERE " + pCur->discrcolid + " < " + pCur->discrval;
-    mybins.clear();
-		mybins = GetColumns(thisdb, s_exe, &rc);
-		if (rc != SQLITE_OK)
-		{
-      pCur->base.pVtab->zErrMsg = sqlite3_mprintf(sqlite3_errmsg(thisdb));
-			return rc;
-		}
-    pCur->ratiohistogram2 = CalcHistogram(mybins, pCur->nbins, pCur->minbin, pCur->maxbin, &rc);
-		if (rc != SQLITE_OK)
-			return rc;
+    pCur->base.pVtab->zErrMsg = sqlite3_mprintf("%s", errmsg.c_str());
+    return rc;
+  }
+  std::string s_tbl = QuoteTableName(pCur->tblname);
+
+  // only scan rows with values inside the histogram range
+  std::string s_where = BinRangeClause(QuoteId(pCur->colid), pCur->whereclause);
+  std::vector<double> params = { pCur->minbin, pCur->maxbin };
+  pCur->scanplan = "";
+  std::string s_columns = QuoteId(pCur->colid);
+  std::vector<std::string> colids = { pCur->colid };
+  std::function<void(const columnset &)> accumulate = [pCur, varedges](const columnset &batch)
+  {
+    AccumHistogram(pCur->ratiohistogram1.data(), pCur->nbins, columnview(batch, 0),
+      pCur->minbin, pCur->maxbin, varedges);
+  };
+  if (pCur->discrcolid != "") 
+  { /* make two ratiohistograms for values above and below discrval in a single scan by
+    reading the discriminator column along with the column to bin
+    */
+    s_columns += ", " + QuoteId(pCur->discrcolid);
+    colids.push_back(pCur->discrcolid);
+    accumulate = [pCur, varedges](const columnset &batch)
+    {
+      AccumRatioHistogram(pCur->ratiohistogram1.data(), pCur->ratiohistogram2.data(),
+        pCur->nbins, columnview(batch, 0), columnview(batch, 1), pCur->discrval,
+        pCur->minbin, pCur->maxbin, varedges);
+    };
+  }
+  sqlite3_int64 ncached = 0;
+  if (pCur->sample > 0.0)
+  { // bin a random sample of the rows
+    rc = SampleReadBatches(thisdb, s_tbl, SelectSql(s_columns, s_tbl, ""),
+      s_where, params, pCur->sample, &pCur->stats, accumulate);
+    pCur->scansql = pCur->stats.sqlxprs;
+  }
+  else if (pCur->whereclause == "" && ColumnCacheReady(thisdb, pCur->tblname, colids, &ncached))
+  { // read the values from the blocks of the columnar cache
+    rc = CachedReadBatches(thisdb, pCur->tblname, colids, ncached, accumulate);
+    pCur->scanplan = ColumnCachePlan(pCur->tblname, colids);
   }
+  else
+  {
+    pCur->scansql = SelectSql(s_columns, s_tbl, s_where);
+    rc = ReadBatches(thisdb, pCur->scansql, params, accumulate);
+  }
+  if (rc != SQLITE_OK)
+  {
+    pCur->base.pVtab->zErrMsg = sqlite3_mprintf(sqlite3_errmsg(thisdb));
+    return rc;
+  }
+  FinalizeHistogram(pCur->ratiohistogram1.data(), pCur->nbins);
+  FinalizeHistogram(pCur->ratiohistogram2.data(), pCur->nbins);
+
   pCur->bin = pCur->ratiohistogram1[0].binval;
   pCur->count1 = pCur->ratiohistogram1[0].count;
   pCur->count2 = pCur->ratiohistogram2[0].count;
@@ -404,6 +494,9 @@ int ratiohistoBestIndex(
   int maxbinidx = -1;
   int discrcolididx = -1;
   int discrvalidx = -1;
+  int whereidx = -1;
+  int sampleidx = -1;
+  int binscaleidx = -1;
   int nArg = 0;          /* Number of arguments that ratiohistoFilter() expects */
 
   sqlite3_index_info::sqlite3_index_constraint *pConstraint;
@@ -440,6 +533,15 @@ int ratiohistoBestIndex(
         discrvalidx = i;
         idxNum = RATIOHISTO_DISCRVAL;
         break;
+      case RATIOHISTO_WHERE:
+        whereidx = i;
+        break;
+      case RATIOHISTO_SAMPLE:
+        sampleidx = i;
+        break;
+      case RATIOHISTO_BINSCALE:
+        binscaleidx = i;
+        break;
     }
   }
   if(tblnameidx >=0 ){
@@ -470,6 +572,21 @@ int ratiohistoBestIndex(
     pIdxInfo->aConstraintUsage[discrvalidx].argvIndex = ++nArg;
     pIdxInfo->aConstraintUsage[discrvalidx].omit = 1;
   }
+  if (whereidx >= 0) { // optional arguments follow the required ones
+    pIdxInfo->aConstraintUsage[whereidx].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[whereidx].omit = 1;
+    idxNum |= ARG_WHERE;
+  }
+  if (sampleidx >= 0) {
+    pIdxInfo->aConstraintUsage[sampleidx].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[sampleidx].omit = 1;
+    idxNum |= ARG_SAMPLE;
+  }
+  if (binscaleidx >= 0) {
+    pIdxInfo->aConstraintUsage[binscaleidx].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[binscaleidx].omit = 1;
+    idxNum |= ARG_BINSCALE;
+  }
   pIdxInfo->estimatedCost = 2.0;
   pIdxInfo->estimatedRows = 500;
   if( pIdxInfo->nOrderBy==1 )
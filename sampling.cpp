@@ -0,0 +1,235 @@
+/*
+sampling.cpp
+
+Drawing random samples of table rows for approximate histograms and estimating bin counts
+of all rows from the bin counts of a sample.
+
+The MIT License (MIT)
+
+Copyright (c) 2017 Robert Oeffner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "helpers.h"
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <unordered_set>
+
+
+/* Looking up a rowid costs more than reading the next row of a sequential scan. Samples
+larger than this fraction of the rowids are therefore drawn from a scan of the table.
+*/
+const double MAXLOOKUPFRACTION = 0.02;
+
+
+
+static std::mt19937_64 SampleRng()
+{
+  if (histoconfig.sampleseed != 0)
+    return std::mt19937_64(histoconfig.sampleseed);
+  return std::mt19937_64(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+}
+
+
+/* Ascending list of the rowids between minrowid and maxrowid in a Bernoulli sample with
+probability fraction. The gaps between sampled rowids are geometrically distributed so
+only the sampled rowids are generated.
+*/
+static std::vector<sqlite3_int64> BernoulliRowids(std::mt19937_64 &rng, sqlite3_int64 minrowid,
+                                                  sqlite3_int64 maxrowid, double fraction)
+{
+  std::vector<sqlite3_int64> rowids;
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  double logq = log1p(-fraction);
+  double rowid = (double)minrowid - 1.0;
+  while (true)
+  {
+    double u = 1.0 - uniform(rng); // in (0, 1]
+    rowid += 1.0 + floor(log(u) / logq);
+    if (rowid > (double)maxrowid)
+      break;
+    rowids.push_back((sqlite3_int64)rowid);
+  }
+  return rowids;
+}
+
+
+/* Ascending list of nsample distinct rowids drawn uniformly between minrowid and maxrowid
+with Floyd's algorithm
+*/
+static std::vector<sqlite3_int64> DistinctRowids(std::mt19937_64 &rng, sqlite3_int64 minrowid,
+                                                 sqlite3_int64 maxrowid, sqlite3_int64 nsample)
+{
+  std::unordered_set<sqlite3_int64> chosen;
+  sqlite3_int64 nrowids = maxrowid - minrowid + 1;
+  for (sqlite3_int64 j = nrowids - nsample; j < nrowids; j++)
+  {
+    std::uniform_int_distribution<sqlite3_int64> pick(0, j);
+    sqlite3_int64 t = pick(rng);
+    if (!chosen.insert(minrowid + t).second)
+      chosen.insert(minrowid + j);
+  }
+  std::vector<sqlite3_int64> rowids(chosen.begin(), chosen.end());
+  std::sort(rowids.begin(), rowids.end());
+  return rowids;
+}
+
+
+int SampleReadBatches(sqlite3* db, std::string tblname, std::string selectxprs,
+                      std::string whereclause, const std::vector<double> &params, double sample,
+                      samplestats *stats, std::function<void(const columnset &)> accumulate,
+                      int textcol)
+{
+  std::mt19937_64 rng = SampleRng();
+  bool bernoulli = sample < 1.0;
+  *stats = samplestats();
+  stats->bernoulli = bernoulli;
+  stats->fraction = bernoulli ? sample : 1.0;
+
+  sqlite3_int64 minrowid = 0, maxrowid = 0;
+  bool empty = false;
+  int rc = RowidRange(db, tblname, &minrowid, &maxrowid, &empty);
+  bool lookup = false;
+  if (rc == SQLITE_OK && !empty)
+  {
+    double nrowids = (double)(maxrowid - minrowid) + 1.0;
+    lookup = bernoulli ? sample < MAXLOOKUPFRACTION : sample < MAXLOOKUPFRACTION * nrowids;
+  }
+
+  if (lookup)
+  { // look up the sampled rowids one by one in ascending order
+    std::vector<sqlite3_int64> rowids;
+    if (bernoulli)
+    {
+      rowids = BernoulliRowids(rng, minrowid, maxrowid, sample);
+    }
+    else
+    {
+      rowids = DistinctRowids(rng, minrowid, maxrowid, (sqlite3_int64)sample);
+      stats->nsampled = rowids.size();
+      stats->population = (double)(maxrowid - minrowid) + 1.0;
+    }
+
+    int rowidparam = params.size() + 1;
+    stats->sqlxprs = selectxprs + " WHERE rowid = ?" + std::to_string(rowidparam);
+    if (whereclause != "")
+      stats->sqlxprs += " AND (" + whereclause + ")";
+    sqlite3_stmt *stmt = GetCachedStmt(db, stats->sqlxprs, &rc);
+    if (rc != SQLITE_OK)
+      return rc;
+    ColumnReader reader(stmt, textcol);
+    rc = reader.Bind(params);
+    if (rc != SQLITE_OK)
+      return rc;
+
+    columnset batch(reader.ncols());
+    for (unsigned r = 0; r < rowids.size(); r++)
+    {
+      rc = reader.ReadRowid(batch, rowidparam, rowids[r]);
+      if (rc != SQLITE_DONE)
+        return rc;
+      if (batch.nrows >= BATCHSIZE)
+      {
+        accumulate(batch);
+        batch.Clear();
+      }
+    }
+    accumulate(batch);
+    return SQLITE_OK;
+  }
+
+  // scan the table and keep a Bernoulli sample or a reservoir sample of the rows
+  stats->sqlxprs = selectxprs;
+  if (whereclause != "")
+    stats->sqlxprs += " WHERE (" + whereclause + ")";
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  columnset reservoir;
+  sqlite3_int64 nreservoir = bernoulli ? 0 : (sqlite3_int64)sample;
+  sqlite3_int64 nseen = 0;
+  rc = ReadBatches(db, stats->sqlxprs, params, [&](const columnset &batch)
+  {
+    if (reservoir.vals.size() != batch.vals.size())
+      reservoir.Reset(batch.vals.size());
+    for (unsigned j = 0; j < batch.nrows; j++)
+    {
+      nseen++;
+      if (bernoulli)
+      {
+        if (uniform(rng) < sample)
+          reservoir.AppendRow(batch, j);
+      }
+      else if (reservoir.nrows < nreservoir)
+      {
+        reservoir.AppendRow(batch, j);
+      }
+      else
+      { // replace a random row in the reservoir with probability nreservoir/nseen
+        std::uniform_int_distribution<sqlite3_int64> pick(0, nseen - 1);
+        sqlite3_int64 r = pick(rng);
+        if (r < nreservoir)
+          reservoir.SetRow((unsigned)r, batch, j);
+      }
+    }
+    if (bernoulli && reservoir.nrows >= BATCHSIZE)
+    { // a Bernoulli sample need not be kept until the end of the scan
+      accumulate(reservoir);
+      reservoir.Clear();
+    }
+  }, textcol);
+  if (rc != SQLITE_OK)
+    return rc;
+  accumulate(reservoir);
+  if (!bernoulli)
+  {
+    stats->nsampled = reservoir.nrows;
+    stats->population = nseen;
+  }
+  return SQLITE_OK;
+}
+
+
+void EstimateCount(const samplestats &stats, sqlite3_int64 count,
+                   double *estcount, double *cilower, double *ciupper)
+{
+  const double z = 1.96; // Z score of a 95% confidence interval
+  double c = count;
+  double sd = 0.0;
+  *estcount = 0.0;
+  if (stats.bernoulli)
+  { // the count of a Bernoulli sample is a binomial variable with probability fraction
+    *estcount = c / stats.fraction;
+    sd = sqrt(c * (1.0 - stats.fraction)) / stats.fraction;
+  }
+  else if (stats.nsampled > 0)
+  { // proportion in a simple random sample with finite population correction
+    double N = stats.population;
+    double n = stats.nsampled;
+    double p = c / n;
+    double fpc = N > 1.0 ? (N - n) / (N - 1.0) : 0.0;
+    *estcount = N * p;
+    sd = N * sqrt(p * (1.0 - p) / n * fpc);
+  }
+  *cilower = *estcount - z * sd;
+  if (*cilower < 0.0)
+    *cilower = 0.0;
+  *ciupper = *estcount + z * sd;
+}